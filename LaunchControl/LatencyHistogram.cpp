@@ -0,0 +1,150 @@
+#if defined(_MSC_VER)
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#include <intrin.h>
+#endif
+
+#include "stdafx.h"
+#include "LatencyHistogram.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+
+//Position of the highest bit set in value, which is not 0.
+static unsigned int highestBit(unsigned long long value)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+#if defined(_M_X64)
+	_BitScanReverse64(&index, value);
+#else
+	if (_BitScanReverse(&index, (unsigned long)(value >> 32)))
+		return index + 32;
+	_BitScanReverse(&index, (unsigned long)value);
+#endif
+	return index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+	reset();
+}
+
+void LatencyHistogram::reset()
+{
+	for (unsigned int i = 0; i < BUCKET_COUNT; i++)
+		counts[i].store(0, std::memory_order_relaxed);
+	sum.store(0, std::memory_order_relaxed);
+	minimum.store(LLONG_MAX, std::memory_order_relaxed);
+	maximum.store(0, std::memory_order_relaxed);
+}
+
+unsigned int LatencyHistogram::bucketIndex(unsigned long long value)
+{
+	const unsigned int subBuckets = 1 << SUB_BUCKET_BITS;
+	if (value < subBuckets)
+		return (unsigned int)value;
+	unsigned int bit = highestBit(value);
+	if (bit >= MAX_VALUE_BITS)
+		return BUCKET_COUNT - 1;
+	//The SUB_BUCKET_BITS highest bits of the value, the first of which is always set
+	unsigned int subBucket = (unsigned int)(value >> (bit - (SUB_BUCKET_BITS - 1)));
+	return subBuckets + (bit - SUB_BUCKET_BITS) * (subBuckets / 2) + (subBucket - subBuckets / 2);
+}
+
+long long LatencyHistogram::bucketEnd(unsigned int index)
+{
+	const unsigned int subBuckets = 1 << SUB_BUCKET_BITS;
+	if (index < subBuckets)
+		return index;
+	unsigned int bit = SUB_BUCKET_BITS + (index - subBuckets) / (subBuckets / 2);
+	unsigned long long subBucket = subBuckets / 2 + (index - subBuckets) % (subBuckets / 2);
+	return (long long)(((subBucket + 1) << (bit - (SUB_BUCKET_BITS - 1))) - 1);
+}
+
+void LatencyHistogram::record(long long nanoseconds)
+{
+	if (nanoseconds < 0)
+		nanoseconds = 0;
+	counts[bucketIndex((unsigned long long)nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+	//Extremes only change for the first records, the loads are enough afterwards
+	long long current = minimum.load(std::memory_order_relaxed);
+	while (nanoseconds < current && !minimum.compare_exchange_weak(current, nanoseconds, std::memory_order_relaxed))
+		;
+	current = maximum.load(std::memory_order_relaxed);
+	while (nanoseconds > current && !maximum.compare_exchange_weak(current, nanoseconds, std::memory_order_relaxed))
+		;
+}
+
+unsigned long long LatencyHistogram::count() const
+{
+	unsigned long long total = 0;
+	for (unsigned int i = 0; i < BUCKET_COUNT; i++)
+		total += counts[i].load(std::memory_order_relaxed);
+	return total;
+}
+
+long long LatencyHistogram::minValue() const
+{
+	long long value = minimum.load(std::memory_order_relaxed);
+	return value == LLONG_MAX ? 0 : value;
+}
+
+long long LatencyHistogram::maxValue() const
+{
+	return maximum.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::mean() const
+{
+	unsigned long long total = count();
+	return total == 0 ? 0.0 : (double)sum.load(std::memory_order_relaxed) / total;
+}
+
+long long LatencyHistogram::valueAtPercentile(double percentile) const
+{
+	unsigned long long total = count();
+	if (total == 0)
+		return 0;
+
+	percentile = (std::min)((std::max)(percentile, 0.0), 100.0);
+	unsigned long long rank = (unsigned long long)std::ceil(percentile / 100.0 * total);
+	if (rank == 0)
+		rank = 1;
+
+	unsigned long long seen = 0;
+	for (unsigned int i = 0; i < BUCKET_COUNT; i++)
+	{
+		seen += counts[i].load(std::memory_order_relaxed);
+		//The last bucket has no end, its values are only known not to exceed the maximum
+		if (seen >= rank)
+			return i == BUCKET_COUNT - 1 ? maxValue() : (std::min)(bucketEnd(i), maxValue());
+	}
+	return maxValue();
+}
+
+void LatencyHistogram::print(std::ostream& out, const std::string& name) const
+{
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out.setf(std::ios::fixed);
+	out.precision(1);
+
+	out << name << ": " << count() << " messages, mean " << mean() / 1000.0
+		<< ", min " << minValue() / 1000.0
+		<< ", p50 " << valueAtPercentile(50.0) / 1000.0
+		<< ", p90 " << valueAtPercentile(90.0) / 1000.0
+		<< ", p99 " << valueAtPercentile(99.0) / 1000.0
+		<< ", p99.9 " << valueAtPercentile(99.9) / 1000.0
+		<< ", max " << maxValue() / 1000.0 << " us\n";
+
+	out.flags(flags);
+	out.precision(precision);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <ostream>
+#include <string>
+
+//Histogram of latencies in nanoseconds, in the manner of HdrHistogram: the buckets get wider
+//as the values grow, 32 buckets per power of two, so every value is known within 1/32 (3%)
+//from 64 ns to 18 minutes, with a fixed array of counters and no allocation.
+//
+//record() is lock free and can be called from several threads at once. The queries read the
+//counters while they change, so they can be called at any time, their result lagging at most
+//the records being made.
+//
+//	histogram.record(RtMidiEvent::now() - event.arrivalTime);
+//	histogram.valueAtPercentile(99.0);
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void record(long long nanoseconds);
+	//Must not be called while records are being made.
+	void reset();
+
+	unsigned long long count() const;
+	long long minValue() const;
+	long long maxValue() const;
+	double mean() const;
+	//The value which percentile (0-100) percent of the records do not exceed, as the highest
+	//value of its bucket. 0 if nothing was recorded.
+	long long valueAtPercentile(double percentile) const;
+
+	//Prints a line with the count, then the mean, min, p50, p90, p99, p99.9 and max in microseconds.
+	void print(std::ostream& out, const std::string& name) const;
+
+	//Values of 2^MAX_VALUE_BITS ns and more are counted in the last bucket.
+	static const unsigned int SUB_BUCKET_BITS = 6;
+	static const unsigned int MAX_VALUE_BITS = 40;
+	//64 buckets of 1 ns, then 32 buckets for each power of two up to MAX_VALUE_BITS
+	static const unsigned int BUCKET_COUNT = (1 << SUB_BUCKET_BITS) + (MAX_VALUE_BITS - SUB_BUCKET_BITS) * (1 << (SUB_BUCKET_BITS - 1));
+
+private:
+	std::atomic<unsigned long long> counts[BUCKET_COUNT];
+	std::atomic<long long> sum;
+	std::atomic<long long> minimum;
+	std::atomic<long long> maximum;
+
+	static unsigned int bucketIndex(unsigned long long value);
+	static long long bucketEnd(unsigned int index);
+};
@@ -1,21 +1,24 @@
+#if defined(_MSC_VER)
 #define _CRTDBG_MAP_ALLOC
 #include <stdlib.h>
 #include <crtdbg.h>
+#endif
 
 #include "stdafx.h"
 #include "LaunchControl.h"
+#include "LaunchControlSysEx.h"
+#include "MidiCapture.h"
 #include <algorithm>
 #include <string>
 #include <iostream>
+#include <thread>
 
 
 const std::string LaunchControl::DEVICE_NAME = "Launch Control";
 const std::string LaunchControl::ERROR_DEVICE_NOT_FOUND = "It was not possible to locate a MIDI controller containing the name '" + LaunchControl::DEVICE_NAME + "'.\nPlease make sure LaunchControl is connected.";
 
-//This is a pointer which allows using the midiInCallBack not as a static object.
-void* ptMidiCallback;
-//Wrapper to the callback.
-void midiInCallbackWrapper(double deltatime, std::vector< unsigned char > *message, void *);
+//Wrapper to the callback. userData is the LaunchControl which opened the port.
+void midiInCallbackWrapper(const RtMidiEvent &event, void *userData);
 
 
 //A list of all possible color brightness. It can be used to iterate over possible colors
@@ -28,7 +31,7 @@ Constructor.
 Note: the values below correspond to Factory Template number 1.
 If you are not sure which template is currently set, hold the Factory button in the device.
 */
-LaunchControl::LaunchControl(bool toggleMode, LaunchControl::LogMode logMode) : midiin(nullptr), midiout(nullptr),
+LaunchControl::LaunchControl(bool toggleMode, LaunchControl::LogMode logMode, RtMidi::Api api) : midiin(nullptr), midiout(nullptr),
 SYSEX_ID{ 0x00, 0x20, 0x29 },
 KNOB_1_LOW{ 184, 41, 0 },
 KNOB_2_LOW{ 184, 42, 0 },
@@ -53,7 +56,11 @@ PAD_4{ 152, 12, 127 },
 PAD_5{ 152, 25, 127 },
 PAD_6{ 152, 26, 127 },
 PAD_7{ 152, 27, 127 },
-PAD_8{ 152, 28, 127 }
+PAD_8{ 152, 28, 127 },
+pendingEvents(EVENT_QUEUE_SIZE), pendingEventsOverflow(false), pendingEventsOverflows(0), pendingEventsHighWater(0),
+updateMaxEvents(0), updateMaxTime(0), autoFlush(true), flashClockStopping(false),
+outputThreadRunning(false), outputPending(false), outputStopping(false), outputBytesPerSecond(0), templateChanging(false),
+latencyTracking(false), latencyDumpOnExit(false), captureWriter(nullptr), activeTemplate(LED_TEMPLATE)
 {
 	//Setting up the controls values
 	//TODO The knobs might have a different value at start up,
@@ -61,93 +68,231 @@ PAD_8{ 152, 28, 127 }
 	//For this reason is recommend to assume that the knobs are always at 0 
 	//during start up.
 
-	ptMidiCallback = this;
 	forceToggleMode = toggleMode;
+	this->logMode = logMode;
+	inputCallback = &midiInCallbackWrapper;
+
+	buildDecodeTable();
+
+	for (int control = 0; control < Controls::UNKNOWN; control++)
+		subscriptions[control] = { nullptr, nullptr };
+	anySubscription = { nullptr, nullptr };
+
+	for (int control = 0; control <= Controls::UNKNOWN; control++)
+		controlCounts[control].store(0);
+
+	stateSequence.store(0);
+	for (int control = 0; control < Controls::UNKNOWN; control++)
+	{
+		stateValues[control].store(controlData[control][2]);
+		stateTimes[control].store(0);
+		controlTimes[control] = 0;
+	}
+
+	//The LEDs are assumed off, but their actual state is unknown until they are first sent.
+	for (int templateNumber = 0; templateNumber < TEMPLATE_COUNT; templateNumber++)
+	{
+		for (int led = 0; led < LED_COUNT; led++)
+		{
+			ledFrame[templateNumber][led].store(ColorBrightnessEnum::Off);
+			ledSent[templateNumber][led] = LED_UNKNOWN;
+		}
+		ledDirty[templateNumber].store(0);
+		doubleBuffered[templateNumber] = false;
+		displayBuffer[templateNumber] = 0;
+		hiddenLeds[templateNumber] = 0;
+		flashEnabled[templateNumber] = false;
+	}
+	for (int pad = 0; pad < 8; pad++)
+		echoTimes[pad].store(0);
 
 	// RtMidiIn constructor
-	midiin = new RtMidiIn();
-	midiout = new RtMidiOut();
+	midiin = new RtMidiIn(api);
+	midiout = new RtMidiOut(api);
 }
 
-void LaunchControl::init() {
-	openLaunchControlMidiPorts(midiin, midiout);
-
-	// Set our callback function.  This should be done immediately after
-	// opening the port to avoid having incoming messages written to the
-	// queue instead of sent to the callback function.
-	midiin->setCallback(&midiInCallbackWrapper, 0);
+void LaunchControl::init(unsigned int deviceIndex) {
+	// Set our callback function.  This is done before opening the port
+	// to avoid having incoming messages written to the queue instead of
+	// sent to the callback function, as a replayed capture starts
+	// sending at once.
+	// Each instance receives its own messages through userData.
+	midiin->setCallback(inputCallback, this);
 
 	// Don't ignore sysex, timing, or active sensing messages.
 	midiin->ignoreTypes(false, false, false);
 
+	openLaunchControlMidiPorts(midiin, midiout, deviceIndex);
+}
+
+void LaunchControl::buildDecodeTable()
+{
+	//Same order as the Controls enum
+	Pad* pads[] = { &PAD_1, &PAD_2, &PAD_3, &PAD_4, &PAD_5, &PAD_6, &PAD_7, &PAD_8 };
+	Knob* knobs[] = { &KNOB_1_LOW, &KNOB_2_LOW, &KNOB_3_LOW, &KNOB_4_LOW, &KNOB_5_LOW, &KNOB_6_LOW, &KNOB_7_LOW, &KNOB_8_LOW,
+		&KNOB_1_UPPER, &KNOB_2_UPPER, &KNOB_3_UPPER, &KNOB_4_UPPER, &KNOB_5_UPPER, &KNOB_6_UPPER, &KNOB_7_UPPER, &KNOB_8_UPPER };
+
+	for (int i = 0; i < 8; i++)
+		controlData[Controls::PAD1 + i] = pads[i]->data;
+	for (int i = 0; i < 16; i++)
+		controlData[Controls::KNOB_1 + i] = knobs[i]->data;
+
+	std::fill(&decodeTable[0][0], &decodeTable[0][0] + sizeof(decodeTable) / sizeof(Controls), Controls::UNKNOWN);
+
+	//Filling backwards, so that if two controls share the same status and data1
+	//the first one in the enum wins, as it did when the controls were compared one by one.
+	for (int control = Controls::UNKNOWN - 1; control >= 0; control--)
+	{
+		unsigned char* data = controlData[control];
+		decodeTable[data[0] & 0x7F][data[1] & 0x7F] = (Controls)control;
+	}
 }
 
 LaunchControl::~LaunchControl()
 {
+	setFlashRate(0);
+	stopOutputThread();
+	stopCapture();
+	if (latencyDumpOnExit)
+		printLatency(std::cout);
 	delete midiin;
 	delete midiout;
+	delete captureWriter;
+#if defined(_MSC_VER)
 	_CrtDumpMemoryLeaks();
+#endif
+}
+
+void LaunchControl::midiInCallback(const RtMidiEvent &event)
+{
+	LaunchControl::Controls launchPadControl = processEvent(event);
+	if (launchPadControl == Controls::UNKNOWN)
+		return;
+
+	unsigned char value = latestValue(launchPadControl);
+	const Subscription& subscription = subscriptions[launchPadControl];
+	if (subscription.callback != nullptr || anySubscription.callback != nullptr)
+		recordLatency(LATENCY_NOTIFIED, event.arrivalTime);
+	if (subscription.callback != nullptr)
+		subscription.callback(*this, launchPadControl, value, event, subscription.userData);
+	if (anySubscription.callback != nullptr)
+		anySubscription.callback(*this, launchPadControl, value, event, anySubscription.userData);
 }
 
-void LaunchControl::midiInCallback(double deltatime, std::vector< unsigned char > *message, void *)
+LaunchControl::Controls LaunchControl::processEvent(const RtMidiEvent &event)
 {
 #if DEBUG
-	printMessage(deltatime, *message);
+	printMessage(event);
 #endif
 
+	LaunchControl::Controls launchPadControl = messageToControl(event);
+	if (launchPadControl != Controls::UNKNOWN)
+		recordLatency(LATENCY_APPLIED, event.arrivalTime);
 
-	int nBytes = message->size();
-	if (nBytes <= 3) {
-		LaunchControl::Controls launchPadControl = messageToControl(*message);
 
+	int launchPadControlValue = (int)event.data2();
 
-		int launchPadControlValue = (int)message->at(2);
 
+	if (forceToggleMode && isPad(launchPadControl))
+	{
+		//lighting up LED according to last value
+		//PAD_n is only updated by update(), the latest value is the one just published.
+		echoPad(launchPadControl, latestValue(launchPadControl), event.arrivalTime);
+	}
+	if (logMode == LogMode::DEBUG) {
+		std::string controlName = getControlName(event);
+		std::cout << "[" << (int)event.status() << "," << (int)event.data1() << "," << (int)event.data2() << "]";
+		std::cout << " LaunchControl  = " << (int)launchPadControl << ", " << controlName;
+		std::cout << " Control value= " << launchPadControlValue << "\n";
+	}
 
-		if (forceToggleMode)
-		{
-			//lighting up LED according to last value
-			std::string controlName = getControlName(*message);
-			auto controlValue = controlValues(launchPadControl);
-			if (controlValue != nullptr) {
-				if (controlValue[2] == 127)
-					setPadColor(launchPadControl, ColorBrightnessEnum::RedFull);
-				if (controlValue[2] == 0)
-					setPadColor(launchPadControl, ColorBrightnessEnum::Off);
-			}
+	return launchPadControl;
+}
 
-		}
-		if (logMode == LogMode::DEBUG) {
-			std::string controlName = getControlName(*message);
-			std::cout << "[" << (int)message->at(0) << "," << (int)message->at(1) << "," << (int)message->at(2) << "]";
-			std::cout << " LaunchControl  = " << launchPadControl << ", " << controlName;
-			std::cout << " Control value= " << launchPadControlValue << "\n";
-		}
-	}
+void LaunchControl::onPad(int pad, ControlCallback callback, void *userData)
+{
+	if (pad < 1 || pad > 8)
+		throw RtMidiError("LaunchControl::onPad: the pad number must be between 1 and 8.", RtMidiError::INVALID_PARAMETER);
+
+	subscriptions[Controls::PAD1 + pad - 1] = { callback, userData };
+}
+
+void LaunchControl::onKnob(int knob, ControlCallback callback, void *userData)
+{
+	if (knob < 1 || knob > 16)
+		throw RtMidiError("LaunchControl::onKnob: the knob number must be between 1 and 16.", RtMidiError::INVALID_PARAMETER);
+
+	subscriptions[Controls::KNOB_1 + knob - 1] = { callback, userData };
+}
 
+void LaunchControl::onAny(ControlCallback callback, void *userData)
+{
+	anySubscription = { callback, userData };
 }
 
 
-void midiInCallbackWrapper(double deltatime, std::vector< unsigned char > *message, void *)
+void midiInCallbackWrapper(const RtMidiEvent &event, void *userData)
 {
 	//this wrapper is a solution for the fact that midin.setCallback requires a static
 	//pointer
 
-	//this class
-	LaunchControl* launchControl = (LaunchControl*)ptMidiCallback;
-	launchControl->midiInCallback(deltatime, message, 0);
+	//the instance passed to setCallback in init()
+	LaunchControl* launchControl = (LaunchControl*)userData;
+	launchControl->midiInCallback(event);
 
 }
 
-void LaunchControl::update()
+unsigned int LaunchControl::update()
 {
+	auto start = std::chrono::steady_clock::now();
+	bool overflow = pendingEventsOverflow.exchange(false, std::memory_order_acquire);
+
+	unsigned int applied = 0;
+	ControlEvent event;
+	while (pendingEvents.pop(event))
+	{
+		controlData[event.control][2] = event.value;
+		controlTimes[event.control] = event.time;
+		applied++;
+
+		if (updateMaxEvents != 0 && applied >= updateMaxEvents)
+			break;
+		//Reading the clock only every 16 events keeps the budget check cheap.
+		if (updateMaxTime.count() != 0 && (applied & 15) == 0
+			&& std::chrono::steady_clock::now() - start >= updateMaxTime)
+			break;
+	}
+
+	if (overflow)
+	{
+		//Some events were lost, the latest values are taken from the MIDI thread instead.
+		//The queue is emptied before the snapshot is taken, so the events queued in between are
+		//newer than the values copied and are applied by the next update().
+		ControlEvent discarded;
+		while (pendingEvents.pop(discarded))
+			;
+		ControlSnapshot latest = snapshot();
+		for (int control = 0; control < Controls::UNKNOWN; control++)
+		{
+			controlData[control][2] = latest.values[control];
+			controlTimes[control] = latest.times[control];
+		}
+	}
 
+	return applied;
+}
+
+void LaunchControl::setUpdateBudget(unsigned int maxEvents, std::chrono::microseconds maxTime)
+{
+	updateMaxEvents = maxEvents;
+	updateMaxTime = maxTime;
 }
 std::vector<unsigned char> LaunchControl::GetSysExMessage(std::vector<unsigned char> * dataBytes)
 {
 	//Header (1 byte) + Manufacturer ID (3 bytes) + [data] + Tail (1 bytes) = 4 + size(dataBytes)
 	int sizeInByte = dataBytes->size();
 	std::vector<unsigned char> sysexMsg;
+	sysexMsg.reserve(sizeInByte + 5);
 
 	sysexMsg.push_back(SYSSEX_HEAD);
 
@@ -182,316 +327,631 @@ LED is the index of the pad/button (00h-07h (0-7) for pads, 08h-0Bh (8-11) for b
 and Value is the velocity byte that defines the brightness values of both the red and green LEDs.
 
 */
-void LaunchControl::setPadColor(int padNumber, ColorBrightnessEnum color)
+void LaunchControl::sendLed(unsigned char templateNumber, int led, unsigned char value)
 {
-	//set LED color is fixed, always has these 3 bytes
-	std::vector<unsigned char> setColorFixed;
-	setColorFixed.push_back(0x02);
-	setColorFixed.push_back(0x0A);
-	setColorFixed.push_back(0x78);
-
-	//Template. Factory 1
-	setColorFixed.push_back(0x08);
+	//Pre-encoded at compile time, for every template, LED and velocity
+	LaunchControlSysEx::Message message = LaunchControlSysEx::ledMessage(templateNumber, led, value);
+	sendOutput(message.data, message.size);
+	completeEcho(templateNumber, led, true);
+}
 
-	//index of the pad / button(00h - 07h(0 - 7) for pads, 08h-0Bh(8 - 11) for buttons);
-	setColorFixed.push_back(padNumber);
+void LaunchControl::completeEcho(unsigned char templateNumber, int led, bool sent)
+{
+	if (!latencyTracking.load(std::memory_order_relaxed) || led >= 8 || templateNumber != activeTemplate.load(std::memory_order_relaxed))
+		return;
+	//A LED which needed no message forgets the press, so that a later change is not counted for it
+	long long arrivalTime = echoTimes[led].exchange(0, std::memory_order_relaxed);
+	if (sent)
+		recordLatency(LATENCY_LED_SENT, arrivalTime);
+}
 
-	//Velocity byte. For LED operations, velocity has the brightness and color of the LED.
-	setColorFixed.push_back(color);
-	midiout->sendMessage(&GetSysExMessage(&setColorFixed));
+void LaunchControl::writeLed(unsigned char templateNumber, int led, unsigned char value)
+{
+	if (led < 0 || led >= LED_COUNT)
+		throw RtMidiError("LaunchControl::writeLed: the LED number must be between 0 and 11.", RtMidiError::INVALID_PARAMETER);
+
+	templateNumber &= 0x0F;
+	//The value is stored before the dirty bit is set, so that flush() never sees the bit without the value.
+	//flush() compares it with the color last sent, and skips the LED if it did not change.
+	ledFrame[templateNumber][led].store(value, std::memory_order_relaxed);
+	ledDirty[templateNumber].fetch_or((unsigned short)(1 << led), std::memory_order_release);
 }
 
-void LaunchControl::setTemplate(unsigned char templateNumber)
+void LaunchControl::setPadColor(int padNumber, ColorBrightnessEnum color)
 {
-	//Fixed sequence for template
-	std::vector<unsigned char> setTemplateMessage;
-	setTemplateMessage.push_back(0x02);
-	setTemplateMessage.push_back(0x0A);
-	setTemplateMessage.push_back(0x77);
+	writeLed(activeTemplate.load(std::memory_order_relaxed), padNumber, color);
+	if (autoFlush.load(std::memory_order_relaxed))
+		flush();
+}
 
-	//Template. Factory 1
-	setTemplateMessage.push_back(templateNumber);
+void LaunchControl::setAllPadColors(ColorBrightnessEnum color)
+{
+	unsigned char templateNumber = activeTemplate.load(std::memory_order_relaxed);
+	for (int pad = 0; pad < 8; pad++)
+		writeLed(templateNumber, pad, color);
+	if (autoFlush.load(std::memory_order_relaxed))
+		flush();
+}
 
-	midiout->sendMessage(&GetSysExMessage(&setTemplateMessage));
+void LaunchControl::setAllPadColors(const ColorBrightnessEnum colors[8])
+{
+	unsigned char templateNumber = activeTemplate.load(std::memory_order_relaxed);
+	for (int pad = 0; pad < 8; pad++)
+		writeLed(templateNumber, pad, colors[pad]);
+	if (autoFlush.load(std::memory_order_relaxed))
+		flush();
 }
-/*
-Reset Launch Control. Hex version Bnh, 00h, 00h. Dec version 176+n, 0, 0
-All LEDs are turned off, and the buffer settings and duty cycle are reset to their default values. The
-MIDI channel n defines the template for which this message is intended (00h-07h (0-7) for the 8
-user templates, and 08h-0Fh (8-15) for the 8 factory templates).
-*/
-void LaunchControl::resetLaunchControl(unsigned char templateNumber)
+
+void LaunchControl::setLedColor(unsigned char templateNumber, int led, unsigned char velocity)
 {
-	auto message = std::vector<unsigned char>({ (unsigned char)(176 + templateNumber), 0x00, 0x00 });
-	midiout->sendMessage(&message);
+	writeLed(templateNumber, led, velocity);
 }
 
+LaunchControl::ColorBrightnessEnum LaunchControl::padColor(int pad) const
+{
+	if (pad < 0 || pad >= LED_COUNT)
+		throw RtMidiError("LaunchControl::padColor: the pad number must be between 0 and 11.", RtMidiError::INVALID_PARAMETER);
 
+	return (ColorBrightnessEnum)ledFrame[activeTemplate.load(std::memory_order_relaxed)][pad].load(std::memory_order_relaxed);
+}
 
-std::string  LaunchControl::getControlName(std::vector<unsigned char>& message)
+void LaunchControl::echoPad(Controls pad, unsigned char value, long long arrivalTime)
 {
-	std::string result = "";
-	bool pad = true;
-	auto controlEnum = messageToControl(message);
-	switch (controlEnum)
+	ColorBrightnessEnum color = value == 127 ? ColorBrightnessEnum::RedFull : ColorBrightnessEnum::Off;
+	unsigned char templateNumber = activeTemplate.load(std::memory_order_relaxed);
+	//Stored before the LED is written, for the thread which sends it
+	if (latencyTracking.load(std::memory_order_relaxed))
+		echoTimes[pad].store(arrivalTime, std::memory_order_relaxed);
+	writeLed(templateNumber, pad, color);
+
+	//Deferred to the output thread or to the next flush(), as any other LED change
+	if (outputThreadRunning.load(std::memory_order_acquire))
 	{
-		//TODO right now I "force" a switch always
-	case Controls::PAD1:
-		break;
-	case Controls::PAD2:
-		break;
-	case Controls::PAD3:
-		break;
-	case Controls::PAD4:
-		break;
-	case Controls::PAD5:
-		break;
-	case Controls::PAD6:
-		break;
-	case Controls::PAD7:
-		break;
-	case Controls::PAD8:
-		break;
-	default:
-		pad = false;
-		break;
-	}
-
-	if (pad) {
-		result = "PAD " + std::to_string(controlEnum + 1);
-		return result;
+		requestOutput();
+		return;
 	}
+	if (!autoFlush.load(std::memory_order_relaxed))
+		return;
 
-	//handling the knobs
-	switch (controlEnum) {
-		//For knows, we also update the value of the control
-	case Controls::KNOB_1:
-
-		break;
-	case Controls::KNOB_2:
-		break;
-	case Controls::KNOB_3:
-		break;
-	case Controls::KNOB_4:
-		break;
-	case Controls::KNOB_5:
-		break;
-	case Controls::KNOB_6:
-		break;
-	case Controls::KNOB_7:
-		break;
-	case Controls::KNOB_8:
-		break;
-	case Controls::KNOB_9:
-		break;
-	case Controls::KNOB_10:
-		break;
-	case Controls::KNOB_11:
-		break;
-	case Controls::KNOB_12:
-		break;
-	case Controls::KNOB_13:
-		break;
-	case Controls::KNOB_14:
-		break;
-	case Controls::KNOB_15:
-		break;
-	case Controls::KNOB_16:
-		break;
-	case Controls::UNKNOWN:
-		return "UNKNOWN";
-		break;
+	//Sending the pre-encoded message of this LED only, instead of flushing every template.
+	//The dirty bit is left set, the next flush() will find the LED already sent.
+	std::unique_lock<std::mutex> lock(ledMutex);
+	if (doubleBuffered[templateNumber])
+	{
+		//The double buffered flags and the buffer swap are handled by flushLeds()
+		lock.unlock();
+		flushLeds(false);
+		return;
 	}
-	if (!pad)
-		result = "KNOB " + std::to_string(controlEnum - 7);
-	return result;
+	if (ledSent[templateNumber][pad] == color)
+	{
+		completeEcho(templateNumber, pad, false);
+		return;
+	}
+	sendLed(templateNumber, pad, color);
+	ledSent[templateNumber][pad] = color;
 }
 
-unsigned char* LaunchControl::controlValues(LaunchControl::Controls &control)
+void LaunchControl::setAutoFlush(bool enabled)
 {
-	if (control == LaunchControl::Controls::PAD1)
-		return &PAD_1[0];
-	if (control == LaunchControl::Controls::PAD2)
-		return &PAD_2[0];
-	if (control == LaunchControl::Controls::PAD3)
-		return &PAD_3[0];
-	if (control == LaunchControl::Controls::PAD4)
-		return &PAD_4[0];
-	if (control == LaunchControl::Controls::PAD5)
-		return &PAD_5[0];
-	if (control == LaunchControl::Controls::PAD6)
-		return &PAD_6[0];
-	if (control == LaunchControl::Controls::PAD7)
-		return &PAD_7[0];
-	if (control == LaunchControl::Controls::PAD8)
-		return &PAD_8[0];
-
-	return nullptr;
+	autoFlush.store(enabled, std::memory_order_relaxed);
 }
 
-bool LaunchControl::isPad(LaunchControl::Controls &control)
-{
-	switch (control) {
-	case Controls::PAD1:
-		return true;
-		break;
-	case Controls::PAD2:
-		return true;
-		break;
-	case Controls::PAD3:
-		return true;
-		break;
-	case Controls::PAD4:
-		return true;
-		break;
-	case Controls::PAD5:
-		return true;
-		break;
-	case Controls::PAD6:
-		return true;
-		break;
-	case Controls::PAD7:
-		return true;
-		break;
-	case Controls::PAD8:
-		return true;
-		break;
-	default:
-		return false;
-		break;
+unsigned int LaunchControl::flush()
+{
+	if (outputThreadRunning.load(std::memory_order_acquire))
+	{
+		requestOutput();
+		return 0;
 	}
-	return false;
+	return flushLeds(false);
 }
 
-LaunchControl::Controls LaunchControl::messageToControl(std::vector<unsigned char>& message)
+unsigned int LaunchControl::flushLeds(bool paced)
 {
-	int controlValue = message[2];
-
-	//Using memcmp with vector and array will not give
-	//the expected results, even if the corresponding items
-	//have the same value.
-	unsigned char messageToCompare[] = { message.at(0),message.at(1),message.at(2) };
-	LaunchControl::Controls result = Controls::UNKNOWN;
-	if (memcmp(messageToCompare, PAD_1.data, 2) == 0) {
-		PAD_1[2] = abs(PAD_1[2] - controlValue);
-		result = Controls::PAD1;
-	}
-	else if (memcmp(messageToCompare, PAD_2.data, 2) == 0) {
-		PAD_2[2] = abs(PAD_2[2] - controlValue);
-		result = Controls::PAD2;
-	}
-	else if (memcmp(messageToCompare, PAD_3.data, 2) == 0) {
-		PAD_3[2] = abs(PAD_3[2] - controlValue);
-		result = Controls::PAD3;
-	}
-	else if (memcmp(messageToCompare, PAD_4.data, 2) == 0) {
-		PAD_4[2] = abs(PAD_4[2] - controlValue);
-		result = Controls::PAD4;
-	}
-	else if (memcmp(messageToCompare, PAD_5.data, 2) == 0) {
-		PAD_5[2] = abs(PAD_5[2] - controlValue);
-		result = Controls::PAD5;
-	}
-	else if (memcmp(messageToCompare, PAD_6.data, 2) == 0) {
-		PAD_6[2] = abs(PAD_6[2] - controlValue);
-		result = Controls::PAD6;
-	}
-	else if (memcmp(messageToCompare, PAD_7.data, 2) == 0) {
-		PAD_7[2] = abs(PAD_7[2] - controlValue);
-		result = Controls::PAD7;
-	}
-	else if (memcmp(messageToCompare, PAD_8.data, 2) == 0) {
-		PAD_8[2] = abs(PAD_8[2] - controlValue);
-		result = Controls::PAD8;
-	}
-	//KNOBS
-	else if (memcmp(messageToCompare, KNOB_1_LOW.data, 2) == 0) {
-		KNOB_1_LOW[2] = controlValue;
-		result = Controls::KNOB_1;
+	//Each LED is sent with ledMutex held and its newest color, so that a LED changed twice
+	//cannot be sent out of order, even by two flushes at once.
+	std::unique_lock<std::mutex> lock(ledMutex);
+
+	//The template shown by the device first, then the preloaded ones.
+	unsigned char active = activeTemplate.load(std::memory_order_relaxed);
+	unsigned int sent = flushTemplate(lock, active, false, paced);
+	for (int templateNumber = 0; templateNumber < TEMPLATE_COUNT && !templateChanging.load(std::memory_order_relaxed); templateNumber++)
+	{
+		if (templateNumber != active)
+			sent += flushTemplate(lock, templateNumber, true, paced);
 	}
-	else if (memcmp(messageToCompare, KNOB_2_LOW.data, 2) == 0) {
-		KNOB_2_LOW[2] = controlValue;
-		result = Controls::KNOB_2;
+	return sent;
+}
+
+//Sends the changed LEDs of a template, with ledMutex held by lock. Preloading only uses the
+//bandwidth left by the active template: its changes are sent first whenever it has any.
+//When paced, the lock is released while waiting for the link, so that setTemplate and the
+//other LED calls are not held up for the whole sweep.
+unsigned int LaunchControl::flushTemplate(std::unique_lock<std::mutex>& lock, unsigned char templateNumber, bool preload, bool paced)
+{
+	unsigned int sent = 0;
+	for (int led = 0; led < LED_COUNT; led++)
+	{
+		unsigned short dirty = ledDirty[templateNumber].load(std::memory_order_acquire) >> led;
+		if (dirty == 0)
+			break;
+		if ((dirty & 1) == 0)
+			continue;
+		unsigned short bit = (unsigned short)(1 << led);
+		//Waiting for the link before reading the color, so that the newest one is sent.
+		if (paced)
+		{
+			lock.unlock();
+			waitForOutput();
+			lock.lock();
+		}
+		if (preload)
+		{
+			//setTemplate goes before the preloading, which it resumes once done
+			if (templateChanging.load(std::memory_order_relaxed))
+				return sent;
+			//The active template goes first, then this LED is tried again
+			unsigned char active = activeTemplate.load(std::memory_order_relaxed);
+			if (active != templateNumber && ledDirty[active].load(std::memory_order_relaxed) != 0)
+			{
+				sent += flushTemplate(lock, active, false, paced);
+				led--;
+				continue;
+			}
+		}
+		//Each bit is cleared right before its LED is sent, so that the LEDs still waiting
+		//are seen by isPreloaded(). Bits set again from now on are left for the next call.
+		//The LED may also have been sent or reset while the lock was released.
+		if ((ledDirty[templateNumber].fetch_and((unsigned short)~bit, std::memory_order_acquire) & bit) == 0)
+			continue;
+		unsigned char value = ledFrame[templateNumber][led].load(std::memory_order_relaxed);
+		//A LED changed and changed back since the previous flush needs no message.
+		if (value == ledSent[templateNumber][led])
+		{
+			completeEcho(templateNumber, led, false);
+			continue;
+		}
+		//Only writing the hidden buffer
+		unsigned char velocity = value;
+		if (doubleBuffered[templateNumber])
+		{
+			velocity &= ~(LED_FLAG_CLEAR | LED_FLAG_COPY);
+			hiddenLeds[templateNumber] |= bit;
+		}
+		else if ((value & LED_FLAGS) == LED_FLAG_CLEAR && !flashEnabled[templateNumber])
+		{
+			//The first flashing LED of the template turns its flash mode on
+			sendBufferControl(templateNumber, BUFFER_CONTROL | BUFFER_FLASH);
+			flashEnabled[templateNumber] = true;
+		}
+		sendLed(templateNumber, led, velocity);
+		ledSent[templateNumber][led] = value;
+		sent++;
 	}
-	else if (memcmp(messageToCompare, KNOB_3_LOW.data, 2) == 0) {
-		KNOB_3_LOW[2] = controlValue;
-		result = Controls::KNOB_3;
+
+	if (hiddenLeds[templateNumber] != 0)
+	{
+		//Showing the buffer just written, and copying it to the other one, which
+		//becomes the hidden buffer, so the next frame only has to send its changes.
+		displayBuffer[templateNumber] ^= 1;
+		sendBufferControl(templateNumber, displayBuffer[templateNumber] == 1
+			? BUFFER_CONTROL | BUFFER_COPY | BUFFER_DISPLAY_1
+			: BUFFER_CONTROL | BUFFER_COPY | BUFFER_UPDATE_1);
+		hiddenLeds[templateNumber] = 0;
 	}
-	else if (memcmp(messageToCompare, KNOB_4_LOW.data, 2) == 0) {
-		KNOB_4_LOW[2] = controlValue;
-		result = Controls::KNOB_4;
+	return sent;
+}
+
+void LaunchControl::preloadPadColor(unsigned char templateNumber, int pad, ColorBrightnessEnum color)
+{
+	writeLed(templateNumber, pad, color);
+	//Left to the output thread, which sends it when the active template has nothing to send
+	if (outputThreadRunning.load(std::memory_order_acquire))
+		requestOutput();
+}
+
+bool LaunchControl::isPreloaded(unsigned char templateNumber) const
+{
+	return ledDirty[templateNumber & 0x0F].load(std::memory_order_acquire) == 0;
+}
+
+unsigned char LaunchControl::currentTemplate() const
+{
+	return activeTemplate.load(std::memory_order_relaxed);
+}
+
+void LaunchControl::startOutputThread(unsigned int bytesPerSecond)
+{
+	std::lock_guard<std::mutex> lock(outputMutex);
+	if (outputThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> sendLock(outputSendMutex);
+		outputBytesPerSecond = bytesPerSecond;
+		outputNextSend = std::chrono::steady_clock::now();
 	}
-	else if (memcmp(messageToCompare, KNOB_5_LOW.data, 2) == 0) {
-		KNOB_5_LOW[2] = controlValue;
-		result = Controls::KNOB_5;
+	outputStopping = false;
+	outputThreadRunning.store(true, std::memory_order_release);
+	outputThread = std::thread(&LaunchControl::outputThreadLoop, this);
+}
+
+void LaunchControl::stopOutputThread()
+{
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		if (!outputThread.joinable())
+			return;
+		outputStopping = true;
 	}
-	else if (memcmp(messageToCompare, KNOB_6_LOW.data, 2) == 0) {
-		KNOB_6_LOW[2] = controlValue;
-		result = Controls::KNOB_6;
+	outputWake.notify_one();
+	outputThread.join();
+	outputThreadRunning.store(false, std::memory_order_release);
+	{
+		std::lock_guard<std::mutex> sendLock(outputSendMutex);
+		outputBytesPerSecond = 0;
 	}
-	else if (memcmp(messageToCompare, KNOB_7_LOW.data, 2) == 0) {
-		KNOB_7_LOW[2] = controlValue;
-		result = Controls::KNOB_7;
+
+	//Sending what the thread left, now that flush() is synchronous again.
+	flushLeds(false);
+}
+
+void LaunchControl::requestOutput()
+{
+	//Only the first request since the thread last woke up needs to notify it. The mutex is
+	//held while notifying, so that the thread cannot miss it between its check and its wait.
+	if (!outputPending.exchange(true, std::memory_order_acq_rel))
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		outputWake.notify_one();
 	}
-	else if (memcmp(messageToCompare, KNOB_8_LOW.data, 2) == 0) {
-		KNOB_8_LOW[2] = controlValue;
-		result = Controls::KNOB_8;
+}
+
+void LaunchControl::outputThreadLoop()
+{
+	std::unique_lock<std::mutex> lock(outputMutex);
+	while (true)
+	{
+		outputWake.wait(lock, [this] { return outputStopping || outputPending.load(std::memory_order_acquire); });
+		if (outputStopping)
+			break;
 
+		//Changes written from now on wake the thread again
+		outputPending.store(false, std::memory_order_release);
+		lock.unlock();
+		flushLeds(outputBytesPerSecond != 0);
+		lock.lock();
 	}
-	else if (memcmp(messageToCompare, KNOB_1_UPPER.data, 2) == 0) {
-		KNOB_1_UPPER[2] = controlValue;
-		result = Controls::KNOB_9;
+}
+
+void LaunchControl::startCapture(const std::string &path)
+{
+	stopCapture();
+	if (captureWriter == nullptr)
+		captureWriter = new MidiCapture::Writer();
+	captureWriter->open(path);
+	midiin->setCapture(captureWriter);
+}
+
+void LaunchControl::stopCapture()
+{
+	if (captureWriter == nullptr || !captureWriter->isOpen())
+		return;
+	//Returns once the input thread no longer uses the writer, so no message is lost by closing it
+	midiin->setCapture(nullptr);
+	captureWriter->close();
+}
+
+void LaunchControl::setLatencyTracking(bool enabled, bool dumpOnExit)
+{
+	latencyDumpOnExit = enabled && dumpOnExit;
+	latencyTracking.store(enabled, std::memory_order_relaxed);
+}
+
+const LatencyHistogram& LaunchControl::latency(LatencyStage stage) const
+{
+	if (stage >= LATENCY_STAGE_COUNT)
+		throw RtMidiError("LaunchControl::latency: invalid latency stage.", RtMidiError::INVALID_PARAMETER);
+	return latencyHistograms[stage];
+}
+
+void LaunchControl::resetLatency()
+{
+	for (unsigned int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+		latencyHistograms[stage].reset();
+	for (int pad = 0; pad < 8; pad++)
+		echoTimes[pad].store(0, std::memory_order_relaxed);
+}
+
+LaunchControl::Stats LaunchControl::stats() const
+{
+	Stats result;
+	for (int control = 0; control <= Controls::UNKNOWN; control++)
+		result.controlMessages[control] = controlCounts[control].load(std::memory_order_relaxed);
+	result.updateQueueOverflows = pendingEventsOverflows.load(std::memory_order_relaxed);
+	result.updateQueueHighWater = pendingEventsHighWater.load(std::memory_order_relaxed);
+	result.input = midiin->stats();
+	result.output = midiout->stats();
+	return result;
+}
+
+void LaunchControl::printLatency(std::ostream &out) const
+{
+	const char* names[LATENCY_STAGE_COUNT] = { "Applied", "Notified", "LED sent" };
+	out << "Latency from the driver callback:\n";
+	for (unsigned int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+		latencyHistograms[stage].print(out, names[stage]);
+}
+
+//All LED output goes through here. While the output thread paces the LEDs, every message is
+//counted against outputBytesPerSecond, so that the messages sent by the other threads delay
+//the next LEDs instead of overrunning the link.
+void LaunchControl::sendOutput(const unsigned char* message, size_t size)
+{
+	std::lock_guard<std::mutex> lock(outputSendMutex);
+	if (outputBytesPerSecond != 0)
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (outputNextSend < now)
+			outputNextSend = now;
+		outputNextSend += std::chrono::nanoseconds(size * 1000000000LL / outputBytesPerSecond);
 	}
-	else if (memcmp(messageToCompare, KNOB_2_UPPER.data, 2) == 0) {
-		KNOB_2_UPPER[2] = controlValue;
-		result = Controls::KNOB_10;
+	midiout->sendMessage(message, size);
+}
+
+//Waits until the link has had time to send the messages counted by sendOutput. Called with
+//no other lock held.
+void LaunchControl::waitForOutput()
+{
+	std::chrono::steady_clock::time_point nextSend;
+	{
+		std::lock_guard<std::mutex> lock(outputSendMutex);
+		nextSend = outputNextSend;
 	}
-	else if (memcmp(messageToCompare, KNOB_3_UPPER.data, 2) == 0) {
-		KNOB_3_UPPER[2] = controlValue;
-		result = Controls::KNOB_11;
+	std::this_thread::sleep_until(nextSend);
+}
+
+void LaunchControl::setDoubleBuffered(unsigned char templateNumber, bool enabled)
+{
+	std::lock_guard<std::mutex> lock(ledMutex);
+	templateNumber &= 0x0F;
+	if (doubleBuffered[templateNumber] == enabled)
+		return;
+
+	//Displaying buffer 0 and copying it to buffer 1, which is written by the next flush.
+	//When disabling, buffer 0 is both displayed and written, as after a reset. Every swap
+	//copies the displayed buffer, so both buffers already hold the same frame.
+	if (enabled)
+		sendBufferControl(templateNumber, BUFFER_CONTROL | BUFFER_COPY | BUFFER_UPDATE_1);
+	else
+		sendBufferControl(templateNumber, BUFFER_CONTROL);
+	//The LEDs a paced flush has only written to the hidden buffer so far are sent again
+	//by the next flush.
+	for (int led = 0; led < LED_COUNT; led++)
+	{
+		if (hiddenLeds[templateNumber] & (1 << led))
+			ledSent[templateNumber][led] = LED_UNKNOWN;
 	}
-	else if (memcmp(messageToCompare, KNOB_4_UPPER.data, 2) == 0) {
-		KNOB_4_UPPER[2] = controlValue;
-		result = Controls::KNOB_12;
+	ledDirty[templateNumber].fetch_or(hiddenLeds[templateNumber], std::memory_order_release);
+	hiddenLeds[templateNumber] = 0;
+	doubleBuffered[templateNumber] = enabled;
+	displayBuffer[templateNumber] = 0;
+	flashEnabled[templateNumber] = false;
+}
+
+void LaunchControl::setPadFlashing(int pad, ColorBrightnessEnum color)
+{
+	//Written to the buffer being updated, and cleared in the other one, which the device
+	//displays in turn in flash mode.
+	writeLed(activeTemplate.load(std::memory_order_relaxed), pad, (color & ~LED_FLAGS) | LED_FLAG_CLEAR);
+	if (autoFlush.load(std::memory_order_relaxed))
+		flush();
+}
+
+void LaunchControl::setFlashRate(double cyclesPerSecond)
+{
+	{
+		std::lock_guard<std::mutex> lock(flashClockMutex);
+		if (flashClockThread.joinable())
+		{
+			flashClockStopping = true;
+			flashClockWake.notify_one();
+		}
 	}
-	else if (memcmp(messageToCompare, KNOB_5_UPPER.data, 2) == 0) {
-		KNOB_5_UPPER[2] = controlValue;
-		result = Controls::KNOB_13;
+	if (flashClockThread.joinable())
+		flashClockThread.join();
+
+	if (cyclesPerSecond <= 0)
+		return;
+
+	std::lock_guard<std::mutex> lock(flashClockMutex);
+	flashClockStopping = false;
+	flashClockThread = std::thread(&LaunchControl::flashClockLoop, this,
+		std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / (cyclesPerSecond * FLASH_CLOCKS_PER_CYCLE))));
+}
+
+//Sends MIDI clock messages on absolute deadlines, so that the flash rate does not drift.
+//They are not delayed by the pacing of the LEDs, but their bytes are counted in it.
+void LaunchControl::flashClockLoop(std::chrono::steady_clock::duration clockPeriod)
+{
+	const unsigned char clock[] = { 0xF8 };
+	auto deadline = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock(flashClockMutex);
+	while (!flashClockWake.wait_until(lock, deadline, [this] { return flashClockStopping; }))
+	{
+		sendOutput(clock, sizeof(clock));
+		deadline += clockPeriod;
 	}
-	else if (memcmp(messageToCompare, KNOB_6_UPPER.data, 2) == 0) {
-		KNOB_6_UPPER[2] = controlValue;
-		result = Controls::KNOB_14;
+}
+
+/*
+Buffer control. Hex version Bnh, 00h, 20h-3Dh.
+Each template has two LED buffers: one is displayed, and LED messages without the Clear and Copy
+flags only change the one being updated. The channel n is the template, as for the reset message.
+*/
+void LaunchControl::sendBufferControl(unsigned char templateNumber, unsigned char value)
+{
+	const unsigned char message[] = { (unsigned char)(176 + templateNumber), 0x00, value };
+	sendOutput(message, sizeof(message));
+}
+
+void LaunchControl::setTemplate(unsigned char templateNumber)
+{
+	templateNumber &= 0x0F;
+	LaunchControlSysEx::Message message = LaunchControlSysEx::templateMessage(templateNumber);
+
+	//Completing the preloading of the template, if any, so that it is shown complete.
+	//When it was preloaded in the background, switching only costs this message.
+	//A preload in progress stops at the next LED and leaves the lock.
+	templateChanging.store(true, std::memory_order_relaxed);
+	std::unique_lock<std::mutex> lock(ledMutex);
+	templateChanging.store(false, std::memory_order_relaxed);
+	flushTemplate(lock, templateNumber, false, false);
+	sendOutput(message.data, message.size);
+	activeTemplate.store(templateNumber, std::memory_order_relaxed);
+	lock.unlock();
+
+	//The output thread resumes the preloading it left. Without it, the next flush() does.
+	if (outputThreadRunning.load(std::memory_order_acquire))
+		requestOutput();
+}
+/*
+Reset Launch Control. Hex version Bnh, 00h, 00h. Dec version 176+n, 0, 0
+All LEDs are turned off, and the buffer settings and duty cycle are reset to their default values. The
+MIDI channel n defines the template for which this message is intended (00h-07h (0-7) for the 8
+user templates, and 08h-0Fh (8-15) for the 8 factory templates).
+*/
+void LaunchControl::resetLaunchControl(unsigned char templateNumber)
+{
+	const unsigned char message[] = { (unsigned char)(176 + templateNumber), 0x00, 0x00 };
+
+	//The device turns off all the LEDs of the template, and so does the shadow framebuffer.
+	std::lock_guard<std::mutex> lock(ledMutex);
+	sendOutput(message, sizeof(message));
+	templateNumber &= 0x0F;
+	for (int led = 0; led < LED_COUNT; led++)
+	{
+		ledFrame[templateNumber][led].store(ColorBrightnessEnum::Off, std::memory_order_relaxed);
+		ledSent[templateNumber][led] = ColorBrightnessEnum::Off;
 	}
-	else if (memcmp(messageToCompare, KNOB_7_UPPER.data, 2) == 0) {
-		KNOB_7_UPPER[2] = controlValue;
-		result = Controls::KNOB_15;
+	ledDirty[templateNumber].store(0, std::memory_order_release);
+	doubleBuffered[templateNumber] = false;
+	displayBuffer[templateNumber] = 0;
+	hiddenLeds[templateNumber] = 0;
+	flashEnabled[templateNumber] = false;
+}
+
+
+
+std::string  LaunchControl::getControlName(const RtMidiEvent& message)
+{
+	auto controlEnum = lookupControl(message.status(), message.data1());
+	if (controlEnum == Controls::UNKNOWN)
+		return "UNKNOWN";
+
+	if (isPad(controlEnum))
+		return "PAD " + std::to_string(controlEnum + 1);
+
+	return "KNOB " + std::to_string(controlEnum - 7);
+}
+
+unsigned char* LaunchControl::controlValues(LaunchControl::Controls &control)
+{
+	//Only pads have their values returned, the LEDs of the knobs cannot be toggled.
+	if (isPad(control))
+		return controlData[control];
+
+	return nullptr;
+}
+
+bool LaunchControl::isPad(LaunchControl::Controls control)
+{
+	return control <= Controls::PAD8;
+}
+
+LaunchControl::Controls LaunchControl::messageToControl(const RtMidiEvent& message)
+{
+	LaunchControl::Controls result = lookupControl(message.status(), message.data1());
+	//Single writer: no locked increment needed
+	controlCounts[result].store(controlCounts[result].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	if (result == Controls::UNKNOWN)
+		return result;
+
+	int controlValue = message.data2();
+
+	//Pads toggle between 0 and 127 on every press, knobs take the value of the message.
+	//This thread is the only writer of stateValues, so it holds the latest value.
+	unsigned char value = controlValue;
+	if (isPad(result))
+		value = abs(stateValues[result].load(std::memory_order_relaxed) - controlValue);
+
+	publishControl(result, value, message.arrivalTime);
+
+	ControlEvent event = { result, value, message.arrivalTime };
+	if (!pendingEvents.push(event))
+	{
+		pendingEventsOverflow.store(true, std::memory_order_release);
+		pendingEventsOverflows.store(pendingEventsOverflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
 	}
-	else if (memcmp(messageToCompare, KNOB_8_UPPER.data, 2) == 0) {
-		KNOB_8_UPPER[2] = controlValue;
-		result = Controls::KNOB_16;
+	else
+	{
+		unsigned int pending = pendingEvents.size();
+		if (pending > pendingEventsHighWater.load(std::memory_order_relaxed))
+			pendingEventsHighWater.store(pending, std::memory_order_relaxed);
 	}
 
 	return result;
 }
 
+void LaunchControl::publishControl(Controls control, unsigned char value, long long time)
+{
+	unsigned int sequence = stateSequence.load(std::memory_order_relaxed);
+	stateSequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	stateValues[control].store(value, std::memory_order_relaxed);
+	stateTimes[control].store(time, std::memory_order_relaxed);
+
+	stateSequence.store(sequence + 2, std::memory_order_release);
+}
+
+LaunchControl::ControlSnapshot LaunchControl::snapshot() const
+{
+	ControlSnapshot result;
+	unsigned int before, after;
+	do {
+		before = stateSequence.load(std::memory_order_acquire);
+		for (int control = 0; control < Controls::UNKNOWN; control++)
+		{
+			result.values[control] = stateValues[control].load(std::memory_order_relaxed);
+			result.times[control] = stateTimes[control].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		after = stateSequence.load(std::memory_order_relaxed);
+		//Retrying while a write is in progress or happened during the copy
+	} while ((before & 1) != 0 || before != after);
 
-void LaunchControl::printMessage(double deltatime, std::vector< unsigned char >& message)
+	result.sequence = before;
+	return result;
+}
+
+
+void LaunchControl::printMessage(const RtMidiEvent& message)
 {
 	unsigned int nBytes = message.size();
 	std::cout << "Bytes[ " << nBytes << "]: ";
 	for (unsigned int i = 0; i < nBytes; i++)
-		std::cout << (int)message.at(i) << ", ";
+		std::cout << (int)message[i] << ", ";
 	if (nBytes > 0)
-		std::cout << " Timestamp = " << deltatime;
+		std::cout << " Timestamp = " << message.timeStamp << " Arrival (ns) = " << message.arrivalTime;
 
-	if (nBytes <= 3) {
-		LaunchControl::Controls launchPadControl = LaunchControl::messageToControl(message);
-		int launchPadControlValue = (int)message.at(2);
+	LaunchControl::Controls launchPadControl = lookupControl(message.status(), message.data1());
+	int launchPadControlValue = (int)message.data2();
 
-		std::string controlName = getControlName(message);
-		std::cout << " LaunchControl  = " << launchPadControl << ", " << controlName;
-		std::cout << " Control value= " << launchPadControlValue;
-	}
+	std::string controlName = getControlName(message);
+	std::cout << " LaunchControl  = " << (int)launchPadControl << ", " << controlName;
+	std::cout << " Control value= " << launchPadControlValue;
 	std::cout << std::endl;
 
 }
@@ -501,10 +961,17 @@ void LaunchControl::sendMessage(std::vector<unsigned char>* message)
 	midiout->sendMessage(message);
 }
 
-bool LaunchControl::openLaunchControlMidiPorts(RtMidiIn *midiIn, RtMidiOut *midiOut)
+void LaunchControl::sendMessage(const unsigned char* message, size_t size)
+{
+	midiout->sendMessage(message, size);
+}
+
+bool LaunchControl::openLaunchControlMidiPorts(RtMidiIn *midiIn, RtMidiOut *midiOut, unsigned int deviceIndex)
 {
 
 	bool launchControlFound = false;
+	//Number of matching ports still to skip to reach deviceIndex
+	unsigned int skip = deviceIndex;
 
 	// Check inputs.
 	unsigned int nPorts = midiIn->getPortCount();
@@ -524,7 +991,7 @@ bool LaunchControl::openLaunchControlMidiPorts(RtMidiIn *midiIn, RtMidiOut *midi
 		std::cout << "Port " << i << ": " << portName << "\n";
 
 		//Using LaunchControl in this case
-		if (portName.find(DEVICE_NAME) != std::string::npos)
+		if (portName.find(DEVICE_NAME) != std::string::npos && skip-- == 0)
 		{
 			std::cout << "Opening input port " << portName << std::endl;
 			midiIn->openPort(i);
@@ -539,6 +1006,7 @@ bool LaunchControl::openLaunchControlMidiPorts(RtMidiIn *midiIn, RtMidiOut *midi
 
 	//Output ports
 	launchControlFound = false;
+	skip = deviceIndex;
 	nPorts = midiOut->getPortCount();
 
 	if (nPorts == 0) {
@@ -555,7 +1023,7 @@ bool LaunchControl::openLaunchControlMidiPorts(RtMidiIn *midiIn, RtMidiOut *midi
 		std::cout << "  Output port #" << i << ": " << portName << '\n';
 #endif
 		//Using LaunchControl in this case
-		if (portName.find(DEVICE_NAME) != std::string::npos)
+		if (portName.find(DEVICE_NAME) != std::string::npos && skip-- == 0)
 		{
 			std::cout << "Opening output port " << portName << std::endl;
 			midiOut->openPort(i);
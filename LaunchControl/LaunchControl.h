@@ -1,9 +1,17 @@
 #pragma once
 #include <vector>
+#include <array>
+#include <algorithm>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <ostream>
 #include "RtMidi.h"
-
-void midiInCallback(double deltatime, std::vector< unsigned char > *message, void *);
+#include "SpscRing.h"
+#include "LatencyHistogram.h"
 
 class LaunchControl
 {
@@ -69,18 +77,39 @@ public:
 	///	
 	/// <param name="toggleMode">	  	true to enable toggle mode, false to disable it. In toggle mode,
 	/// 								each pad LED will turn on and off after pressing.</param>
+	/// <param name="api">	  	The MIDI API to use. RtMidi::RTMIDI_LOOPBACK connects to in-process
+	/// 						ports (see MidiLoopback) instead of a device.</param>
 	////////////////////////////////////////////////////////////////////////////////////////////////////
-	LaunchControl(bool toggleMode, LaunchControl::LogMode logMode = LogMode::ERR);
-	void init();
+	LaunchControl(bool toggleMode, LaunchControl::LogMode logMode = LogMode::ERR, RtMidi::Api api = RtMidi::UNSPECIFIED);
+	//Opens the MIDI ports and starts receiving messages. deviceIndex selects which
+	//controller to use when several are connected: 0 for the first port whose name contains
+	//DEVICE_NAME, 1 for the second one and so on. Any number of instances can run at the same time.
+	void init(unsigned int deviceIndex = 0);
 	~LaunchControl();
-	bool openLaunchControlMidiPorts(RtMidiIn *midiIn, RtMidiOut *midiOut);
+	bool openLaunchControlMidiPorts(RtMidiIn *midiIn, RtMidiOut *midiOut, unsigned int deviceIndex = 0);
 	
-	void printMessage(double deltaTime, std::vector<unsigned char>& message);
+	void printMessage(const RtMidiEvent& message);
 	void sendMessage(std::vector<unsigned char>* message);
-	std::vector< unsigned char > currentMessage;
+	void sendMessage(const unsigned char* message, size_t size);
+	RtMidiEvent currentMessage;
 
 	std::vector<unsigned char> GetSysExMessage(std::vector<unsigned char> * dataBytes);
 
+	//Same as GetSysExMessage, for data of a size known at compile time. The message is
+	//returned in fixed size storage, so it can be built and sent without allocating.
+	template <size_t N>
+	std::array<unsigned char, N + 5> sysExMessage(const unsigned char(&dataBytes)[N]) const
+	{
+		std::array<unsigned char, N + 5> message;
+		message[0] = (unsigned char)SYSSEX_HEAD;
+		message[1] = SYSEX_ID[0];
+		message[2] = SYSEX_ID[1];
+		message[3] = SYSEX_ID[2];
+		std::copy(dataBytes, dataBytes + N, message.begin() + 4);
+		message[N + 4] = (unsigned char)SYSSEX_TAIL;
+		return message;
+	}
+
 	//MIDI ID for Focusrite/Novation = 0x00, 0x00, 0x29 = (0,32,41)
 	//This can be seen from MIDI.org but also when send the non-standard buttons from the device, 
 	//such as Templates User and Factory
@@ -179,23 +208,381 @@ public:
 		UNKNOWN = 0x18
 	};
 
-	Controls messageToControl(std::vector<unsigned char>& message);
+	//A consistent copy of the values of all controls, taken at one point in time.
+	struct ControlSnapshot
+	{
+		unsigned char values[UNKNOWN];
+		//Arrival time (RtMidiEvent::arrivalTime) of the message which last changed each control,
+		//or 0 if it has not changed yet.
+		long long times[UNKNOWN];
+		//Incremented by 2 on every update of the controls. Two snapshots with the same
+		//sequence hold the same values.
+		unsigned int sequence;
+
+		unsigned char operator[](Controls control) const {
+			return values[control];
+		}
+	};
+
+	//Returns the values of all controls without locking and without blocking the MIDI thread.
+	//Unlike reading PAD_n or KNOB_n_* directly, it is safe to call from any thread and
+	//never returns a partially applied update.
+	ControlSnapshot snapshot() const;
+
+	//Decodes the message, publishes the new value of the control to snapshot() and queues
+	//it for the next update(). PAD_n and KNOB_n_* only change when update() is called.
+	Controls messageToControl(const RtMidiEvent& message);
+	//Returns the control matching the status and first data byte of a message, without changing its value.
+	Controls lookupControl(unsigned char status, unsigned char data1) const
+	{
+		return decodeTable[status & 0x7F][data1 & 0x7F];
+	}
+	//Rebuilds the decode table from the first two bytes of each PAD_n and KNOB_n_*.
+	//Must be called again if those bytes are changed, for instance to match a different template.
+	void buildDecodeTable();
 	//Returns a label for the control, such as "PAD 1" or "KNOB 1". Non-standard, just to identify which control sent the message.
-	std::string  LaunchControl::getControlName(std::vector<unsigned char>& message);
+	std::string getControlName(const RtMidiEvent& message);
 	unsigned char* controlValues(LaunchControl::Controls& control);
-	static bool isPad(LaunchControl::Controls& control);
-	void LaunchControl::setPadColor(int pad, ColorBrightnessEnum color);
-	void LaunchControl::setTemplate(unsigned char templateNumber);
-	void LaunchControl::resetLaunchControl(unsigned char templateNumber);
+	static bool isPad(LaunchControl::Controls control);
+	//Selects the template shown by the device, whose LEDs are then set by setPadColor. Its LEDs
+	//which are still to be preloaded are sent first. The preloading of the other templates is
+	//interrupted meanwhile, and resumed afterwards.
+	void setTemplate(unsigned char templateNumber);
+	void resetLaunchControl(unsigned char templateNumber);
+
+	//Templates 00h-07h are the user templates, 08h-0Fh the factory templates. Each one has
+	//LEDs 00h-07h for the pads and 08h-0Bh for the buttons.
+	static const int TEMPLATE_COUNT = 16;
+	static const int LED_COUNT = 12;
+	//Template selected at start up, whose LEDs are set by setPadColor and setAllPadColors
+	//until setTemplate is called: Factory template 1.
+	static const unsigned char LED_TEMPLATE = 0x08;
+	//The template last selected with setTemplate.
+	unsigned char currentTemplate() const;
+
+	//The device keeps the LEDs of every template. Pages of a show can be preloaded into the
+	//templates not shown, so that switching to one only costs the setTemplate message.
+	//Preloaded LEDs are sent by the output thread with the bandwidth left by the active
+	//template, or by the next flush() without it. Preloading is complete when isPreloaded().
+	void preloadPadColor(unsigned char templateNumber, int pad, ColorBrightnessEnum color);
+	bool isPreloaded(unsigned char templateNumber) const;
+
+	//LED colors are written to a shadow framebuffer, which keeps the colors wanted by the
+	//application and the colors last sent to the device. flush() sends only the LEDs whose
+	//color differs, so setting a LED to the color it already shows costs no MIDI traffic.
+	//setPadColor and setAllPadColors flush right away unless auto flush is disabled.
+	//pad is 0-7 for the pads and 8-11 for the buttons.
+	void setPadColor(int pad, ColorBrightnessEnum color);
+	void setAllPadColors(ColorBrightnessEnum color);
+	void setAllPadColors(const ColorBrightnessEnum colors[8]);
+	//Writes the LED of any template to the shadow framebuffer, without sending it even with
+	//auto flush enabled. velocity is a ColorBrightnessEnum value, or any LED velocity byte.
+	void setLedColor(unsigned char templateNumber, int led, unsigned char velocity);
+	//The color of a LED in the shadow framebuffer, which may not have been sent yet.
+	ColorBrightnessEnum padColor(int pad) const;
+
+	//Sends the LEDs changed since the previous flush, in every template. Returns the
+	//number of messages sent. Can be called from any thread. While the output thread is
+	//running, it only wakes the thread up and returns 0.
+	unsigned int flush();
+	//With auto flush disabled, changes are only sent by flush(), for instance once per frame
+	//after all LEDs have been set. Enabled by default.
+	void setAutoFlush(bool enabled);
+
+	//In double buffered mode, flush() writes the changed LEDs of the template to the buffer
+	//which is not displayed, then swaps the two buffers with a single 3-byte message, so a
+	//whole frame appears at once. Best used with auto flush disabled, one flush() per frame.
+	//resetLaunchControl() turns the mode off, as the device resets its buffer settings.
+	void setDoubleBuffered(unsigned char templateNumber, bool enabled);
+
+	//Makes a pad or button flash between color and off. The device flashes the LED by itself,
+	//so blinking costs no further MIDI messages. The flash mode of the template is turned on
+	//by the flush() which sends the first flashing LED. Flashing LEDs are shown steady in
+	//double buffered templates, whose buffers are swapped by flush() instead.
+	void setPadFlashing(int pad, ColorBrightnessEnum color);
+
+	//Flashing follows MIDI clock messages (F8h) when the device receives them, with one flash
+	//cycle per beat of 24 clocks. Any other rate than the device's own therefore needs a
+	//steady stream of clocks: they are sent by a thread of their own, 24 x cyclesPerSecond
+	//single byte messages per second. Zero stops the clock, which is the default.
+	void setFlashRate(double cyclesPerSecond);
+
+	//Rate of a MIDI 1.0 link: 31250 bits per second, and 10 bits per byte.
+	static const unsigned int MIDI_BYTES_PER_SECOND = 3125;
 
-	//Not working
-	void LaunchControl::midiInCallback(double deltatime, std::vector< unsigned char > *message, void *);
+	//Moves the LED output to a thread of its own, so that setPadColor and flush() never wait
+	//for MIDI I/O, even from the input callback in toggle mode. Colors written while the thread
+	//is sending replace the pending ones, so only the newest color of each LED is sent. The
+	//messages are paced to bytesPerSecond, or sent as fast as possible if it is 0.
+	//stopOutputThread() sends the changes still pending, and is called by the destructor.
+	void startOutputThread(unsigned int bytesPerSecond = MIDI_BYTES_PER_SECOND);
+	void stopOutputThread();
+
+	//Records the messages received from the device to a capture file, which the RTMIDI_REPLAY
+	//API plays back (see MidiCapture.h and MidiReplay). The input thread only copies each
+	//message to a preallocated ring, and a thread of the capture writes the file. Throws an
+	//RtMidiError if the file cannot be created. stopCapture() is called by the destructor.
+	void startCapture(const std::string &path);
+	void stopCapture();
+
+	//Stages of the handling of a message, whose latency is measured from its arrival in the
+	//driver callback (RtMidiEvent::arrivalTime).
+	enum LatencyStage : unsigned int
+	{
+		//The new value of the control is visible to snapshot()
+		LATENCY_APPLIED = 0,
+		//The handler subscribed to the control is about to be called
+		LATENCY_NOTIFIED = 1,
+		//The LED message echoing a pad in toggle mode was handed to the MIDI output
+		LATENCY_LED_SENT = 2,
+		LATENCY_STAGE_COUNT = 3
+	};
+
+	//Records the latency of every stage in a histogram, which costs a clock read and a few
+	//relaxed atomic operations per stage and message. Disabled by default. With dumpOnExit,
+	//the destructor prints the histograms to the console.
+	void setLatencyTracking(bool enabled, bool dumpOnExit = false);
+	//Can be read at any time, from any thread.
+	const LatencyHistogram& latency(LatencyStage stage) const;
+	void resetLatency();
+	void printLatency(std::ostream &out) const;
+
+	//Counters of an instance since it was created, copied by stats(). The MIDI thread only
+	//increments them, so monitoring can poll stats() at any rate without slowing it down.
+	struct Stats
+	{
+		//Messages decoded for each control, and at UNKNOWN those of no control
+		unsigned long long controlMessages[UNKNOWN + 1];
+		//Events which did not fit in the queue of update(), see EVENT_QUEUE_SIZE
+		unsigned long long updateQueueOverflows;
+		//Most events ever waiting for update()
+		unsigned int updateQueueHighWater;
+		//Messages received from the device, by type, with the drops and high-water mark of the input queue
+		RtMidiInStats input;
+		//Messages sent to the device, LEDs, templates and MIDI clock included
+		RtMidiOutStats output;
+	};
+	Stats stats() const;
+
+	//Called from the MIDI thread for each incoming message.
+	void midiInCallback(const RtMidiEvent &event);
+
+	//Handler called from the MIDI thread when a control sends a message. value is the new
+	//value of the control, which for pads is 127 or 0 after toggling.
+	typedef void(*ControlCallback)(LaunchControl &launchControl, Controls control, unsigned char value, const RtMidiEvent &event, void *userData);
+
+	//Subscribes to the messages of pad 1 to 8, knob 1 to 16 (KNOB_1_LOW to KNOB_8_UPPER)
+	//or of any control. A single handler is kept per control, and a null callback unsubscribes.
+	//Subscriptions should be changed before init(), as they are read without locking.
+	void onPad(int pad, ControlCallback callback, void *userData = 0);
+	void onKnob(int knob, ControlCallback callback, void *userData = 0);
+	void onAny(ControlCallback callback, void *userData = 0);
 	
 
 
 	//Must be called regurlarly to update the controls values with the value of the last MIDI message.
-	void update();
+	//Applies the events received since the previous call to PAD_n and KNOB_n_*, so that they
+	//hold the same values during a whole frame. Returns the number of events applied.
+	unsigned int update();
+
+	//Limits the work done by each update(). Events left over are applied by the following calls.
+	//Zero disables the corresponding limit, which is the default.
+	void setUpdateBudget(unsigned int maxEvents, std::chrono::microseconds maxTime = std::chrono::microseconds(0));
+
+	//Number of events which update() can hold between two calls. If more events arrive,
+	//update() copies the latest values from snapshot() instead.
+	static const unsigned int EVENT_QUEUE_SIZE = 1024;
+
+protected:
+	//Callback given to RtMidiIn by init(), with this instance as userData.
+	//Subclasses may replace it in their constructor.
+	RtMidiCallback inputCallback;
+
+	//Decodes and applies a message, and echoes pad presses to the LEDs in toggle mode.
+	//Everything midiInCallback() does except calling the subscribed handlers.
+	Controls processEvent(const RtMidiEvent &event);
+
+	//The latest value of a control. Only meant to be called from the MIDI thread.
+	unsigned char latestValue(Controls control) const
+	{
+		return stateValues[control].load(std::memory_order_relaxed);
+	}
 
+	//Adds the time elapsed since arrivalTime to the histogram of the stage, if latency is tracked.
+	void recordLatency(LatencyStage stage, long long arrivalTime)
+	{
+		if (latencyTracking.load(std::memory_order_relaxed) && arrivalTime != 0)
+			latencyHistograms[stage].record(RtMidiEvent::now() - arrivalTime);
+	}
+
+public:
+
+	//Arrival time (RtMidiEvent::arrivalTime) of the message which set the current value of
+	//PAD_n or KNOB_n_*, as of the last update(). 0 if the control has not changed yet.
+	long long lastChangeTime(Controls control) const
+	{
+		return controlTimes[control];
+	}
+
+private:
+	//A control changed by the MIDI thread, waiting to be applied by update().
+	struct ControlEvent
+	{
+		Controls control;
+		unsigned char value;
+		long long time;
+	};
+	SpscRing<ControlEvent> pendingEvents;
+	//Set by the MIDI thread when pendingEvents is full.
+	std::atomic<bool> pendingEventsOverflow;
+
+	//Counters of stats(), written by the MIDI thread only
+	std::atomic<unsigned long long> controlCounts[UNKNOWN + 1];
+	std::atomic<unsigned long long> pendingEventsOverflows;
+	std::atomic<unsigned int> pendingEventsHighWater;
+	unsigned int updateMaxEvents;
+	std::chrono::microseconds updateMaxTime;
+
+	struct Subscription
+	{
+		ControlCallback callback;
+		void *userData;
+	};
+	//Handlers indexed by Controls, and the one called for every control.
+	Subscription subscriptions[UNKNOWN];
+	Subscription anySubscription;
+
+	//Decode table indexed by [status & 0x7F][data1 & 0x7F]. Each incoming message is
+	//resolved with a single lookup instead of being compared against every control.
+	Controls decodeTable[128][128];
+	//Storage of each control (PAD_n.data, KNOB_n_*.data), indexed by Controls.
+	unsigned char* controlData[UNKNOWN];
+	//Arrival time of the value in controlData, written by update().
+	long long controlTimes[UNKNOWN];
+
+	//Seqlock holding the values published to snapshot(). The sequence is odd while
+	//the MIDI thread, the only writer, is changing the values.
+	std::atomic<unsigned int> stateSequence;
+	std::atomic<unsigned char> stateValues[UNKNOWN];
+	std::atomic<long long> stateTimes[UNKNOWN];
+	void publishControl(Controls control, unsigned char value, long long time);
+
+	//Shadow framebuffer. ledDirty has a bit per LED written and not sent yet, in each
+	//template. ledSent is only accessed with ledMutex held.
+	std::atomic<unsigned char> ledFrame[TEMPLATE_COUNT][LED_COUNT];
+	std::atomic<unsigned short> ledDirty[TEMPLATE_COUNT];
+	unsigned char ledSent[TEMPLATE_COUNT][LED_COUNT];
+	std::mutex ledMutex;
+	std::atomic<bool> autoFlush;
+	//Value of ledSent for a LED whose color on the device is not known, as at start up.
+	static const unsigned char LED_UNKNOWN = 0xFF;
+
+	//Double buffering state of each template, accessed with ledMutex held. displayBuffer is
+	//the buffer (0 or 1) shown by the device, the other one receives the LED messages.
+	//hiddenLeds has a bit per LED written to the hidden buffer since it was last shown.
+	bool doubleBuffered[TEMPLATE_COUNT];
+	unsigned char displayBuffer[TEMPLATE_COUNT];
+	unsigned short hiddenLeds[TEMPLATE_COUNT];
+	//Whether the device alternates the buffers of the template to flash the LEDs
+	bool flashEnabled[TEMPLATE_COUNT];
+
+	//MIDI clock setting a flash rate, see setFlashRate.
+	static const int FLASH_CLOCKS_PER_CYCLE = 24;
+	std::thread flashClockThread;
+	std::mutex flashClockMutex;
+	std::condition_variable flashClockWake;
+	bool flashClockStopping;
+	void flashClockLoop(std::chrono::steady_clock::duration clockPeriod);
+
+	//Flags in the LED velocity byte. Clear and Copy write both buffers, which is what the
+	//ColorBrightnessEnum values do. Without them only the buffer being updated is written.
+	//A flashing LED has only the Clear flag, so that the device clears it in the other buffer.
+	static const unsigned char LED_FLAG_CLEAR = 0x08;
+	static const unsigned char LED_FLAG_COPY = 0x04;
+	static const unsigned char LED_FLAGS = 0x0C;
+
+	//Buffer control, Bnh 00h 20h-3Dh: 20h + 16 x Copy + 8 x Flash + 4 x Update + Display.
+	//Display and Update select which buffer is shown and which one is written. Copy makes the
+	//buffer being written a copy of the one shown.
+	static const unsigned char BUFFER_CONTROL = 0x20;
+	static const unsigned char BUFFER_COPY = 0x10;
+	static const unsigned char BUFFER_FLASH = 0x08;
+	static const unsigned char BUFFER_UPDATE_1 = 0x04;
+	static const unsigned char BUFFER_DISPLAY_1 = 0x01;
+
+	//Output thread. The shadow framebuffer is its queue: writers only set dirty bits and wake
+	//the thread, which sends the newest colors. outputStopping is accessed with outputMutex
+	//held. outputSendMutex serializes the messages sent, and guards outputBytesPerSecond and
+	//outputNextSend, the time at which the link is done sending them.
+	std::thread outputThread;
+	std::mutex outputMutex;
+	std::condition_variable outputWake;
+	std::atomic<bool> outputThreadRunning;
+	std::atomic<bool> outputPending;
+	bool outputStopping;
+	std::mutex outputSendMutex;
+	unsigned int outputBytesPerSecond;
+	std::chrono::steady_clock::time_point outputNextSend;
+	void requestOutput();
+	void outputThreadLoop();
+	void waitForOutput();
+	//Set by setTemplate while it waits for ledMutex: a preload stops at the next LED.
+	std::atomic<bool> templateChanging;
+
+	void echoPad(Controls pad, unsigned char value, long long arrivalTime);
+
+	std::atomic<bool> latencyTracking;
+	bool latencyDumpOnExit;
+	LatencyHistogram latencyHistograms[LATENCY_STAGE_COUNT];
+	//Arrival time of the press echoed by each pad LED, until the LED message is sent. 0 if none.
+	std::atomic<long long> echoTimes[8];
+	void completeEcho(unsigned char templateNumber, int led, bool sent);
+
+	//Created by the first startCapture, and reused by the next ones.
+	MidiCapture::Writer *captureWriter;
+
+	//Template selected by setTemplate
+	std::atomic<unsigned char> activeTemplate;
+
+	unsigned int flushLeds(bool paced);
+	unsigned int flushTemplate(std::unique_lock<std::mutex>& lock, unsigned char templateNumber, bool preload, bool paced);
+	void writeLed(unsigned char templateNumber, int led, unsigned char value);
+	void sendLed(unsigned char templateNumber, int led, unsigned char value);
+	void sendBufferControl(unsigned char templateNumber, unsigned char value);
+	void sendOutput(const unsigned char* message, size_t size);
 
 };
 
+//Static dispatch variant of the subscription API. The derived class defines
+//	void onControl(LaunchControl::Controls control, unsigned char value, const RtMidiEvent &event);
+//which is called from the MIDI thread for every message sent by a known control. The call is
+//resolved at compile time, so the handler can be inlined into the decode path.
+//The handlers registered with onPad/onKnob/onAny are not called.
+//
+//	class Rig : public LaunchControlListener<Rig> {
+//	public:
+//		Rig() : LaunchControlListener<Rig>(false) {}
+//		void onControl(LaunchControl::Controls control, unsigned char value, const RtMidiEvent &event) { ... }
+//	};
+template <class Derived>
+class LaunchControlListener : public LaunchControl
+{
+public:
+	LaunchControlListener(bool toggleMode, LaunchControl::LogMode logMode = LogMode::ERR, RtMidi::Api api = RtMidi::UNSPECIFIED)
+		: LaunchControl(toggleMode, logMode, api)
+	{
+		inputCallback = &LaunchControlListener::staticCallback;
+	}
+
+private:
+	static void staticCallback(const RtMidiEvent &event, void *userData)
+	{
+		Derived* self = static_cast<Derived*>((LaunchControl*)userData);
+		Controls control = self->processEvent(event);
+		if (control != UNKNOWN)
+		{
+			self->recordLatency(LATENCY_NOTIFIED, event.arrivalTime);
+			self->onControl(control, self->latestValue(control), event);
+		}
+	}
+};
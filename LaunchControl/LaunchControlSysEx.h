@@ -0,0 +1,126 @@
+#pragma once
+#include <cstddef>
+
+//SysEx messages of the Novation Launch Control, encoded at compile time.
+//Sending one is a table lookup returning a pointer and a length, with no bytes to assemble.
+//This header does not depend on LaunchControl or RtMidi, so other tools can include it alone:
+//
+//	LaunchControlSysEx::Message message = LaunchControlSysEx::ledMessage(0x08, 0, 0x3C);
+//	midiout->sendMessage(message.data, message.size);
+namespace LaunchControlSysEx
+{
+	//Templates 00h-07h are the user templates, 08h-0Fh the factory templates.
+	const unsigned char TEMPLATE_COUNT = 16;
+	//LEDs 00h-07h are the pads, 08h-0Bh the buttons.
+	const unsigned char LED_COUNT = 12;
+	//LED velocities are 16 x Green + Red + Flags, with Green and Red 0-3 and Flags 0Ch, 08h, 04h
+	//or 0, so every valid velocity is below 40h.
+	const unsigned char VELOCITY_COUNT = 0x40;
+
+	//F0h 00h 20h 29h 02h 0Ah 78h Template LED Value F7h
+	const size_t LED_MESSAGE_SIZE = 11;
+	//F0h 00h 20h 29h 02h 0Ah 77h Template F7h
+	const size_t TEMPLATE_MESSAGE_SIZE = 9;
+
+	struct Message
+	{
+		const unsigned char* data;
+		size_t size;
+	};
+
+	namespace detail
+	{
+		struct LedTable
+		{
+			unsigned char bytes[LED_COUNT][VELOCITY_COUNT][LED_MESSAGE_SIZE];
+		};
+
+		struct TemplateTable
+		{
+			unsigned char bytes[TEMPLATE_COUNT][TEMPLATE_MESSAGE_SIZE];
+		};
+
+		constexpr LedTable makeLedTable(unsigned char templateNumber)
+		{
+			LedTable table{};
+			for (unsigned char led = 0; led < LED_COUNT; led++)
+			{
+				for (unsigned char velocity = 0; velocity < VELOCITY_COUNT; velocity++)
+				{
+					unsigned char* message = table.bytes[led][velocity];
+					message[0] = 0xF0;
+					message[1] = 0x00;
+					message[2] = 0x20;
+					message[3] = 0x29;
+					message[4] = 0x02;
+					message[5] = 0x0A;
+					message[6] = 0x78;
+					message[7] = templateNumber;
+					message[8] = led;
+					message[9] = velocity;
+					message[10] = 0xF7;
+				}
+			}
+			return table;
+		}
+
+		constexpr TemplateTable makeTemplateTable()
+		{
+			TemplateTable table{};
+			for (unsigned char templateNumber = 0; templateNumber < TEMPLATE_COUNT; templateNumber++)
+			{
+				unsigned char* message = table.bytes[templateNumber];
+				message[0] = 0xF0;
+				message[1] = 0x00;
+				message[2] = 0x20;
+				message[3] = 0x29;
+				message[4] = 0x02;
+				message[5] = 0x0A;
+				message[6] = 0x77;
+				message[7] = templateNumber;
+				message[8] = 0xF7;
+			}
+			return table;
+		}
+
+		//One table per template, so that each one is a separate, small constant evaluation.
+		//Static members of class templates are defined once for the whole program, even
+		//though this header is included by several translation units.
+		template <unsigned char TemplateNumber>
+		struct LedMessages
+		{
+			static constexpr LedTable table = makeLedTable(TemplateNumber);
+		};
+		template <unsigned char TemplateNumber>
+		constexpr LedTable LedMessages<TemplateNumber>::table;
+
+		template <class Unused = void>
+		struct Tables
+		{
+			static constexpr const LedTable* led[TEMPLATE_COUNT] = {
+				&LedMessages<0x00>::table, &LedMessages<0x01>::table, &LedMessages<0x02>::table, &LedMessages<0x03>::table,
+				&LedMessages<0x04>::table, &LedMessages<0x05>::table, &LedMessages<0x06>::table, &LedMessages<0x07>::table,
+				&LedMessages<0x08>::table, &LedMessages<0x09>::table, &LedMessages<0x0A>::table, &LedMessages<0x0B>::table,
+				&LedMessages<0x0C>::table, &LedMessages<0x0D>::table, &LedMessages<0x0E>::table, &LedMessages<0x0F>::table
+			};
+			static constexpr TemplateTable templates = makeTemplateTable();
+		};
+		template <class Unused>
+		constexpr const LedTable* Tables<Unused>::led[TEMPLATE_COUNT];
+		template <class Unused>
+		constexpr TemplateTable Tables<Unused>::templates;
+	}
+
+	//Sets the LED of a pad or button, in any template, to a velocity (ColorBrightnessEnum value).
+	//led must be below LED_COUNT. The template is taken modulo 16 and the velocity modulo 40h.
+	constexpr Message ledMessage(unsigned char templateNumber, unsigned char led, unsigned char velocity)
+	{
+		return { detail::Tables<>::led[templateNumber & 0x0F]->bytes[led][velocity & 0x3F], LED_MESSAGE_SIZE };
+	}
+
+	//Selects the template shown by the device.
+	constexpr Message templateMessage(unsigned char templateNumber)
+	{
+		return { detail::Tables<>::templates.bytes[templateNumber & 0x0F], TEMPLATE_MESSAGE_SIZE };
+	}
+}
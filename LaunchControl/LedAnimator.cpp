@@ -0,0 +1,194 @@
+#if defined(_MSC_VER)
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#endif
+
+#include "stdafx.h"
+#include "LedAnimator.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <mmsystem.h>
+#endif
+
+
+//Defined here as well, std::fill takes it by reference
+const unsigned char LedAnimator::UNSET;
+
+LedAnimator::LedAnimator(LaunchControl &launchControl, unsigned char templateNumber) : launchControl(launchControl),
+templateNumber(templateNumber), loopDuration(0), stopping(false), playing(false), tickCount(0), missedTickCount(0)
+{
+}
+
+LedAnimator::~LedAnimator()
+{
+	stop();
+}
+
+void LedAnimator::checkLed(int led)
+{
+	if (led < 0 || led >= LaunchControl::LED_COUNT)
+		throw RtMidiError("LedAnimator: the LED number must be between 0 and 11.", RtMidiError::INVALID_PARAMETER);
+}
+
+void LedAnimator::addKeyframe(int led, std::chrono::microseconds time, LaunchControl::ColorBrightnessEnum color, Transition transition)
+{
+	checkLed(led);
+	Keyframe keyframe = { time, (unsigned char)color, transition };
+
+	std::lock_guard<std::mutex> lock(timelineMutex);
+	std::vector<Keyframe> &timeline = timelines[led];
+	//After the keyframes with the same time, so that the last one added wins
+	auto position = std::upper_bound(timeline.begin(), timeline.end(), keyframe,
+		[](const Keyframe &a, const Keyframe &b) { return a.time < b.time; });
+	timeline.insert(position, keyframe);
+}
+
+void LedAnimator::clearKeyframes(int led)
+{
+	checkLed(led);
+	std::lock_guard<std::mutex> lock(timelineMutex);
+	timelines[led].clear();
+}
+
+void LedAnimator::clearKeyframes()
+{
+	std::lock_guard<std::mutex> lock(timelineMutex);
+	for (int led = 0; led < LaunchControl::LED_COUNT; led++)
+		timelines[led].clear();
+}
+
+void LedAnimator::setLoopDuration(std::chrono::microseconds duration)
+{
+	std::lock_guard<std::mutex> lock(timelineMutex);
+	loopDuration = duration;
+}
+
+unsigned char LedAnimator::colorAt(const std::vector<Keyframe> &timeline, std::chrono::microseconds time)
+{
+	auto next = std::upper_bound(timeline.begin(), timeline.end(), time,
+		[](std::chrono::microseconds t, const Keyframe &keyframe) { return t < keyframe.time; });
+	if (next == timeline.begin())
+		return UNSET;
+
+	const Keyframe &previous = *(next - 1);
+	if (next == timeline.end() || next->transition == Step)
+		return previous.color;
+
+	//Fading the red and green levels (0-3) separately, keeping the flags of the previous keyframe
+	double progress = (double)(time - previous.time).count() / (next->time - previous.time).count();
+	int red = previous.color & 0x03;
+	int green = (previous.color >> 4) & 0x03;
+	red += (int)std::lround(((next->color & 0x03) - red) * progress);
+	green += (int)std::lround((((next->color >> 4) & 0x03) - green) * progress);
+	return (unsigned char)((green << 4) | red | (previous.color & 0x0C));
+}
+
+void LedAnimator::colorsAt(std::chrono::microseconds time, unsigned char colors[LaunchControl::LED_COUNT])
+{
+	std::lock_guard<std::mutex> lock(timelineMutex);
+	if (loopDuration.count() > 0)
+		time %= loopDuration;
+	for (int led = 0; led < LaunchControl::LED_COUNT; led++)
+		colors[led] = colorAt(timelines[led], time);
+}
+
+void LedAnimator::start(std::chrono::microseconds period)
+{
+	if (period.count() <= 0)
+		throw RtMidiError("LedAnimator::start: the period must be positive.", RtMidiError::INVALID_PARAMETER);
+
+	std::lock_guard<std::mutex> lock(threadMutex);
+	if (thread.joinable())
+		return;
+	stopping = false;
+	playing.store(true);
+	thread = std::thread(&LedAnimator::run, this, period);
+}
+
+void LedAnimator::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(threadMutex);
+		if (!thread.joinable())
+			return;
+		stopping = true;
+	}
+	stopRequested.notify_one();
+	thread.join();
+	playing.store(false);
+}
+
+bool LedAnimator::isPlaying() const
+{
+	return playing.load();
+}
+
+unsigned long long LedAnimator::ticks() const
+{
+	return tickCount.load(std::memory_order_relaxed);
+}
+
+unsigned long long LedAnimator::missedTicks() const
+{
+	return missedTickCount.load(std::memory_order_relaxed);
+}
+
+void LedAnimator::run(std::chrono::microseconds period)
+{
+#if defined(_WIN32)
+	//The default timer resolution of Windows (15.6ms) is coarser than the ticks
+	timeBeginPeriod(1);
+#endif
+
+	unsigned char sent[LaunchControl::LED_COUNT];
+	std::fill(sent, sent + LaunchControl::LED_COUNT, UNSET);
+	unsigned char colors[LaunchControl::LED_COUNT];
+
+	const auto start = std::chrono::steady_clock::now();
+	long long tick = 0;
+
+	std::unique_lock<std::mutex> lock(threadMutex);
+	while (true)
+	{
+		//Absolute deadline: the time spent sleeping and rendering never shifts the next ticks
+		auto deadline = start + period * tick;
+		if (stopRequested.wait_until(lock, deadline, [this] { return stopping; }))
+			break;
+		lock.unlock();
+
+		//The colors of the scheduled time, not of the time the thread woke up, so that the
+		//animation renders the same frames however late the thread is.
+		colorsAt(period * tick, colors);
+		bool changed = false;
+		for (int led = 0; led < LaunchControl::LED_COUNT; led++)
+		{
+			if (colors[led] == UNSET || colors[led] == sent[led])
+				continue;
+			launchControl.setLedColor(templateNumber, led, colors[led]);
+			sent[led] = colors[led];
+			changed = true;
+		}
+		if (changed)
+			launchControl.flush();
+		tickCount.fetch_add(1, std::memory_order_relaxed);
+
+		//Skipping the ticks whose deadline has already passed by more than a period
+		tick++;
+		auto now = std::chrono::steady_clock::now();
+		if (now - (start + period * tick) >= period)
+		{
+			long long late = (now - start) / period;
+			missedTickCount.fetch_add(late - tick, std::memory_order_relaxed);
+			tick = late;
+		}
+		lock.lock();
+	}
+
+#if defined(_WIN32)
+	timeEndPeriod(1);
+#endif
+}
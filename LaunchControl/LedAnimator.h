@@ -0,0 +1,87 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "LaunchControl.h"
+
+//Plays keyframed LED timelines on the pads and buttons of a LaunchControl.
+//A scheduler thread computes the colors of every LED once per tick, writes the LEDs whose
+//color changed to the shadow framebuffer and flushes them. Ticks are scheduled on absolute
+//deadlines (start + n x period), so sleep jitter never accumulates into drift; ticks missed
+//because the thread was late are skipped instead of being played in a burst.
+//
+//	LedAnimator animator(*launchControl);
+//	animator.addKeyframe(0, std::chrono::milliseconds(0), LaunchControl::RedFull);
+//	animator.addKeyframe(0, std::chrono::milliseconds(500), LaunchControl::Off, LedAnimator::Fade);
+//	animator.setLoopDuration(std::chrono::milliseconds(1000));
+//	animator.start();
+class LedAnimator
+{
+public:
+	//How a LED gets to the color of a keyframe: at once, or fading from the previous keyframe
+	//by steps of the red and green brightness levels.
+	enum Transition : unsigned char
+	{
+		Step = 0,
+		Fade = 1
+	};
+
+	struct Keyframe
+	{
+		std::chrono::microseconds time;
+		unsigned char color;
+		Transition transition;
+	};
+
+	//The LEDs of templateNumber are animated, by default the one used by setPadColor.
+	LedAnimator(LaunchControl &launchControl, unsigned char templateNumber = LaunchControl::LED_TEMPLATE);
+	~LedAnimator();
+
+	//Adds a keyframe to the timeline of a LED (0-7 for the pads, 8-11 for the buttons). time is
+	//counted from start(). A LED is not changed before its first keyframe, and keeps the color of
+	//its last keyframe afterwards. Keyframes can be changed while the animation is playing.
+	void addKeyframe(int led, std::chrono::microseconds time, LaunchControl::ColorBrightnessEnum color, Transition transition = Step);
+	void clearKeyframes(int led);
+	void clearKeyframes();
+
+	//Restarts the timelines every duration. Zero plays them once, which is the default.
+	void setLoopDuration(std::chrono::microseconds duration);
+
+	//Starts the scheduler thread, ticking every period (10ms is 100 ticks per second).
+	void start(std::chrono::microseconds period = std::chrono::microseconds(10000));
+	void stop();
+	bool isPlaying() const;
+
+	//Colors of all the LEDs at a time of the timelines, as the scheduler computes them. LEDs
+	//without a color at that time are set to UNSET. Can be used to render without the thread.
+	static const unsigned char UNSET = 0xFF;
+	void colorsAt(std::chrono::microseconds time, unsigned char colors[LaunchControl::LED_COUNT]);
+
+	//Number of ticks played, and skipped because the thread woke up more than a period late.
+	unsigned long long ticks() const;
+	unsigned long long missedTicks() const;
+
+private:
+	LaunchControl &launchControl;
+	unsigned char templateNumber;
+
+	//Sorted by time. Protected by timelineMutex, as is loopDuration.
+	std::vector<Keyframe> timelines[LaunchControl::LED_COUNT];
+	std::chrono::microseconds loopDuration;
+	std::mutex timelineMutex;
+
+	std::thread thread;
+	std::mutex threadMutex;
+	std::condition_variable stopRequested;
+	bool stopping;
+	std::atomic<bool> playing;
+	std::atomic<unsigned long long> tickCount;
+	std::atomic<unsigned long long> missedTickCount;
+
+	void run(std::chrono::microseconds period);
+	static unsigned char colorAt(const std::vector<Keyframe> &timeline, std::chrono::microseconds time);
+	static void checkLed(int led);
+};
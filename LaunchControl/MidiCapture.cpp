@@ -0,0 +1,367 @@
+#if defined(_MSC_VER)
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#endif
+
+#include "stdafx.h"
+#include "MidiCapture.h"
+#include "MidiFile.h"
+#include <algorithm>
+#include <chrono>
+
+
+namespace MidiCapture
+{
+	//How long the writer thread sleeps between two drains of the ring.
+	static const std::chrono::milliseconds DRAIN_PERIOD(5);
+	//Records drained at once, and size of the output buffer written to the file at once.
+	static const unsigned int DRAIN_BATCH = 256;
+	static const size_t WRITE_SIZE = 64 * 1024;
+
+	unsigned int messageSize(unsigned char status)
+	{
+		if (status < 0xF0)
+			return ((status & 0xE0) == 0xC0) ? 2 : 3;
+		if (status == 0xF0)
+			return 0;
+		if (status == 0xF1 || status == 0xF3)
+			return 2;
+		if (status == 0xF2)
+			return 3;
+		return 1;
+	}
+
+	bool isStatus(unsigned char status)
+	{
+		return status >= 0x80 && status != 0xF4 && status != 0xF5 && status != 0xF7 && status != 0xF9 && status != 0xFD;
+	}
+
+	template <class T>
+	static Source* openFile(const std::string& path)
+	{
+		T* source = new T();
+		try
+		{
+			source->open(path);
+		}
+		catch (RtMidiError&)
+		{
+			delete source;
+			throw;
+		}
+		return source;
+	}
+
+	Source* openSource(const std::string& path)
+	{
+		char magic[4] = { 0, 0, 0, 0 };
+		{
+			std::ifstream file(path, std::ios::binary);
+			file.read(magic, sizeof(magic));
+		}
+		if (std::equal(magic, magic + 4, "MThd"))
+			return openFile<MidiFile::Reader>(path);
+		return openFile<Reader>(path);
+	}
+
+	static void writeQuantity(std::vector<unsigned char>& buffer, unsigned long long value)
+	{
+		unsigned char bytes[10];
+		int count = 0;
+		do
+		{
+			bytes[count++] = (unsigned char)(value & 0x7F);
+			value >>= 7;
+		} while (value != 0);
+		while (count > 1)
+			buffer.push_back(bytes[--count] | 0x80);
+		buffer.push_back(bytes[0]);
+	}
+
+	Writer::Writer(unsigned int capacity) : ring(capacity), capturing(false), capturedCount(0), droppedCount(0),
+		lastTime(0), inSysex(false), stopping(false)
+	{
+		sysex.reserve(1024);
+		buffer.reserve(WRITE_SIZE + 1024);
+	}
+
+	Writer::~Writer()
+	{
+		close();
+	}
+
+	void Writer::open(const std::string& path)
+	{
+		close();
+
+		file.open(path, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			throw RtMidiError("MidiCapture::Writer::open: the file " + path + " cannot be created.", RtMidiError::INVALID_PARAMETER);
+
+		//Records left in the ring from a previous capture
+		while (ring.readSlot() != nullptr)
+			ring.commitRead();
+
+		lastTime = RtMidiEvent::now();
+		unsigned char header[HEADER_SIZE] = { MAGIC[0], MAGIC[1], MAGIC[2], MAGIC[3], VERSION, 0, 0, 0 };
+		for (int i = 0; i < 8; i++)
+			header[8 + i] = (unsigned char)((unsigned long long)lastTime >> (8 * i));
+		file.write((const char*)header, HEADER_SIZE);
+
+		sysex.clear();
+		inSysex = false;
+		capturedCount.store(0);
+		droppedCount.store(0);
+		stopping = false;
+		capturing.store(true);
+		thread = std::thread(&Writer::run, this);
+	}
+
+	void Writer::close()
+	{
+		if (!thread.joinable())
+			return;
+
+		capturing.store(false);
+		{
+			std::lock_guard<std::mutex> lock(threadMutex);
+			stopping = true;
+		}
+		stopRequested.notify_one();
+		thread.join();
+
+		//The thread drained the ring before stopping
+		file.close();
+	}
+
+	bool Writer::isOpen() const
+	{
+		return capturing.load();
+	}
+
+	void Writer::capture(const RtMidiEvent& event)
+	{
+		if (!capturing.load(std::memory_order_relaxed))
+			return;
+
+		Record* record = ring.writeSlot();
+		if (record == nullptr)
+		{
+			droppedCount.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		record->time = event.arrivalTime;
+		record->packet = event.packet;
+		record->flags = EVENT;
+		ring.commitWrite();
+		capturedCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void Writer::captureSysEx(long long arrivalTime, const unsigned char* bytes, size_t nBytes)
+	{
+		if (!capturing.load(std::memory_order_relaxed) || nBytes == 0)
+			return;
+
+		size_t offset = 0;
+		do
+		{
+			Record* record = ring.writeSlot();
+			if (record == nullptr)
+			{
+				//The writer thread drops the chunks already queued, as the last one never comes.
+				droppedCount.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			size_t size = (std::min)(nBytes - offset, (size_t)SYSEX_CHUNK_SIZE);
+			record->time = arrivalTime;
+			record->flags = SYSEX | (offset == 0 ? SYSEX_FIRST : 0) | (offset + size == nBytes ? SYSEX_LAST : 0);
+			record->size = (unsigned char)size;
+			std::copy(bytes + offset, bytes + offset + size, record->bytes);
+			ring.commitWrite();
+			offset += size;
+		} while (offset < nBytes);
+		capturedCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	unsigned long long Writer::capturedMessages() const
+	{
+		return capturedCount.load(std::memory_order_relaxed);
+	}
+
+	unsigned long long Writer::droppedMessages() const
+	{
+		return droppedCount.load(std::memory_order_relaxed);
+	}
+
+	void Writer::run()
+	{
+		std::unique_lock<std::mutex> lock(threadMutex);
+		while (true)
+		{
+			//The producer never notifies: waking up on a timer keeps the input path lock free.
+			bool stop = stopRequested.wait_for(lock, DRAIN_PERIOD, [this] { return stopping; });
+			lock.unlock();
+			drain();
+			if (stop)
+				break;
+			lock.lock();
+		}
+
+		file.write((const char*)buffer.data(), buffer.size());
+		buffer.clear();
+		file.flush();
+	}
+
+	void Writer::drain()
+	{
+		Record records[DRAIN_BATCH];
+		unsigned int count;
+		while ((count = ring.popBatch(records, DRAIN_BATCH)) > 0)
+		{
+			for (unsigned int i = 0; i < count; i++)
+			{
+				const Record& record = records[i];
+				if (record.flags == EVENT)
+				{
+					unsigned char bytes[3] = { (unsigned char)(record.packet >> 16), (unsigned char)(record.packet >> 8), (unsigned char)record.packet };
+					writeMessage(record.time, bytes, messageSize(bytes[0]));
+					continue;
+				}
+
+				if (record.flags & SYSEX_FIRST)
+				{
+					sysex.clear();
+					inSysex = true;
+				}
+				else if (!inSysex)
+					continue;
+				sysex.insert(sysex.end(), record.bytes, record.bytes + record.size);
+				if (record.flags & SYSEX_LAST)
+				{
+					writeMessage(record.time, sysex.data(), sysex.size());
+					inSysex = false;
+				}
+			}
+
+			if (buffer.size() >= WRITE_SIZE)
+			{
+				file.write((const char*)buffer.data(), buffer.size());
+				buffer.clear();
+			}
+		}
+	}
+
+	void Writer::writeMessage(long long time, const unsigned char* bytes, size_t size)
+	{
+		//Messages of several threads may arrive slightly out of order
+		writeQuantity(buffer, time > lastTime ? (unsigned long long)(time - lastTime) : 0);
+		if (time > lastTime)
+			lastTime = time;
+
+		if (bytes[0] == 0xF0)
+		{
+			buffer.push_back(0xF0);
+			writeQuantity(buffer, size - 1);
+			buffer.insert(buffer.end(), bytes + 1, bytes + size);
+		}
+		else
+			buffer.insert(buffer.end(), bytes, bytes + size);
+	}
+
+	Reader::Reader() : fileSize(0), time(0), start(0)
+	{
+		sysex.reserve(1024);
+	}
+
+	void Reader::open(const std::string& path)
+	{
+		close();
+
+		file.open(path, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			throw RtMidiError("MidiCapture::Reader::open: the file " + path + " cannot be opened.", RtMidiError::INVALID_PARAMETER);
+		fileSize = (long long)file.tellg();
+		file.seekg(0);
+
+		unsigned char header[HEADER_SIZE];
+		if (!file.read((char*)header, HEADER_SIZE) || !std::equal(MAGIC, MAGIC + 4, header) || header[4] != VERSION)
+		{
+			file.close();
+			throw RtMidiError("MidiCapture::Reader::open: " + path + " is not a capture file.", RtMidiError::INVALID_PARAMETER);
+		}
+
+		unsigned long long startTime = 0;
+		for (int i = 0; i < 8; i++)
+			startTime |= (unsigned long long)header[8 + i] << (8 * i);
+		start = time = (long long)startTime;
+	}
+
+	void Reader::close()
+	{
+		if (file.is_open())
+			file.close();
+		file.clear();
+	}
+
+	bool Reader::readQuantity(unsigned long long& value)
+	{
+		value = 0;
+		for (int i = 0; i < 10; i++)
+		{
+			int byte = file.get();
+			if (byte == std::char_traits<char>::eof())
+				return false;
+			value = (value << 7) | (byte & 0x7F);
+			if (!(byte & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	bool Reader::next(Message& next)
+	{
+		unsigned long long delta;
+		if (!file.is_open() || !readQuantity(delta))
+			return false;
+
+		int status = file.get();
+		if (status == std::char_traits<char>::eof() || !isStatus((unsigned char)status))
+			return false;
+		time += (long long)delta;
+		next.time = time;
+
+		if (status == 0xF0)
+		{
+			//A corrupt length must neither wrap around nor allocate more than the file holds
+			unsigned long long size;
+			if (!readQuantity(size) || size > MAX_SYSEX_SIZE || (long long)size > fileSize - (long long)file.tellg())
+				return false;
+			sysex.resize((size_t)size + 1);
+			sysex[0] = 0xF0;
+			if (!file.read((char*)sysex.data() + 1, (std::streamsize)size))
+				return false;
+			next.bytes = sysex.data();
+			next.size = sysex.size();
+			return true;
+		}
+
+		message[0] = (unsigned char)status;
+		unsigned int size = messageSize(message[0]);
+		if (size > 1 && !file.read((char*)message + 1, size - 1))
+			return false;
+		for (unsigned int i = 1; i < size; i++)
+		{
+			if (message[i] & 0x80)
+				return false;
+		}
+		next.bytes = message;
+		next.size = size;
+		return true;
+	}
+
+	long long Reader::startTime() const
+	{
+		return start;
+	}
+}
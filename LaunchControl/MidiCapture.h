@@ -0,0 +1,163 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "RtMidi.h"
+#include "SpscRing.h"
+
+//Capture files record the MIDI messages received by an RtMidiIn, with their arrival time in
+//nanoseconds. They are written while playing (see RtMidiIn::setCapture and
+//LaunchControl::startCapture) and played back by the RTMIDI_REPLAY API (see MidiReplay).
+//
+//The format is compact, so that hours of a show fit in a few megabytes:
+//	Header:  "LCAP" 01h 00h 00h 00h, then the start time (8 bytes, little endian)
+//	Records: the time since the previous record (or since the start) as a variable length
+//	         quantity, followed by the message. Channel and system messages are written as
+//	         received, their length being given by the status byte. SysEx messages are
+//	         written as F0h, the number of bytes after F0h as a variable length quantity,
+//	         and those bytes up to and including F7h.
+//Variable length quantities are 7 bits per byte, most significant first, as in MIDI files.
+namespace MidiCapture
+{
+	const unsigned char MAGIC[4] = { 'L', 'C', 'A', 'P' };
+	const unsigned char VERSION = 1;
+	const size_t HEADER_SIZE = 16;
+
+	//Number of bytes of a message starting with status, or 0 for SysEx.
+	unsigned int messageSize(unsigned char status);
+	//Whether status starts a message: not a data byte, an undefined status or the end of a SysEx.
+	bool isStatus(unsigned char status);
+
+	//Longest SysEx message read from a file. Longer ones are taken as a corrupt file.
+	const size_t MAX_SYSEX_SIZE = 1 << 20;
+
+	//A message read from a capture file. bytes stays valid until the next message is read.
+	struct Message
+	{
+		//Arrival time in nanoseconds, in the clock of RtMidiEvent::arrivalTime.
+		long long time;
+		const unsigned char* bytes;
+		size_t size;
+	};
+
+	//A file of timed messages, read one message at a time, which the RTMIDI_REPLAY API can play.
+	class Source
+	{
+	public:
+		virtual ~Source() {}
+
+		//Reads the next message. Returns false at the end of the file, if the file ends in the
+		//middle of a message, or if the message is corrupt.
+		virtual bool next(Message& message) = 0;
+		//Time of the start of the file, to which the time of the messages are relative.
+		virtual long long startTime() const = 0;
+		virtual void close() = 0;
+	};
+
+	//Opens a capture file or a Standard MIDI File (see MidiFile.h), depending on its header.
+	//The source is deleted by the caller. Throws an RtMidiError if the file cannot be opened or
+	//is in neither format.
+	Source* openSource(const std::string& path);
+
+	//Writes a capture file from the input thread of an RtMidiIn.
+	//capture() and captureSysEx() only copy the message to a preallocated ring: they never
+	//lock, allocate or touch the file, so the input path is not slowed down by the disk.
+	//A writer thread drains the ring every few milliseconds and encodes the records to the
+	//file. Messages arriving while the ring is full are dropped and counted.
+	class Writer
+	{
+	public:
+		//capacity is the number of records the ring can hold. A SysEx message takes one record
+		//per SYSEX_CHUNK_SIZE bytes.
+		explicit Writer(unsigned int capacity = DEFAULT_CAPACITY);
+		~Writer();
+
+		//Creates the file and starts the writer thread. Throws an RtMidiError if the file
+		//cannot be created.
+		void open(const std::string& path);
+		//Writes the remaining records, then closes the file.
+		void close();
+		bool isOpen() const;
+
+		//Producer side, called by the thread dispatching the messages.
+		void capture(const RtMidiEvent& event);
+		void captureSysEx(long long arrivalTime, const unsigned char* bytes, size_t nBytes);
+
+		unsigned long long capturedMessages() const;
+		unsigned long long droppedMessages() const;
+
+		static const unsigned int DEFAULT_CAPACITY = 4096;
+		static const unsigned int SYSEX_CHUNK_SIZE = 18;
+
+	private:
+		enum RecordFlags : unsigned char
+		{
+			EVENT = 0,
+			SYSEX = 1,
+			SYSEX_FIRST = 2,
+			SYSEX_LAST = 4
+		};
+
+		//32 bytes
+		struct Record
+		{
+			long long time;
+			unsigned int packet;
+			unsigned char flags;
+			unsigned char size;
+			unsigned char bytes[SYSEX_CHUNK_SIZE];
+		};
+
+		SpscRing<Record> ring;
+		std::atomic<bool> capturing;
+		std::atomic<unsigned long long> capturedCount;
+		std::atomic<unsigned long long> droppedCount;
+
+		std::ofstream file;
+		long long lastTime;
+		//SysEx being reassembled from its records, and output buffer of the writer thread.
+		std::vector<unsigned char> sysex;
+		bool inSysex;
+		std::vector<unsigned char> buffer;
+
+		std::thread thread;
+		std::mutex threadMutex;
+		std::condition_variable stopRequested;
+		bool stopping;
+
+		void run();
+		void drain();
+		void writeMessage(long long time, const unsigned char* bytes, size_t size);
+	};
+
+	//Reads a capture file one message at a time, with a fixed size buffer, so files of any
+	//length are read in constant memory.
+	class Reader : public Source
+	{
+	public:
+		Reader();
+
+		//Throws an RtMidiError if the file cannot be opened or is not a capture file.
+		void open(const std::string& path);
+		void close();
+
+		bool next(Message& message);
+
+		//Time at which the capture started.
+		long long startTime() const;
+
+	private:
+		std::ifstream file;
+		long long fileSize;
+		long long time;
+		long long start;
+		unsigned char message[3];
+		std::vector<unsigned char> sysex;
+
+		bool readQuantity(unsigned long long& value);
+	};
+}
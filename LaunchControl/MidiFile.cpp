@@ -0,0 +1,528 @@
+#if defined(_MSC_VER)
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#endif
+
+#include "stdafx.h"
+#include "MidiFile.h"
+#include <algorithm>
+
+
+namespace MidiFile
+{
+	static const unsigned char HEADER_CHUNK[4] = { 'M', 'T', 'h', 'd' };
+	static const unsigned char TRACK_CHUNK[4] = { 'M', 'T', 'r', 'k' };
+	static const unsigned int HEADER_LENGTH = 6;
+	//Size of the track data written to the file at once
+	static const size_t WRITE_SIZE = 64 * 1024;
+
+	//Meta events: FFh Type Length Data
+	static const unsigned char META_EVENT = 0xFF;
+	static const unsigned char META_TEMPO = 0x51;
+	static const unsigned char META_END_OF_TRACK = 0x2F;
+	//Escape event: F7h Length Bytes, for any message which is not a channel message or SysEx
+	static const unsigned char ESCAPE_EVENT = 0xF7;
+
+	static void putBigEndian(unsigned char* bytes, unsigned int value, int size)
+	{
+		for (int i = 0; i < size; i++)
+			bytes[i] = (unsigned char)(value >> (8 * (size - 1 - i)));
+	}
+
+	static unsigned int getBigEndian(const unsigned char* bytes, int size)
+	{
+		unsigned int value = 0;
+		for (int i = 0; i < size; i++)
+			value = (value << 8) | bytes[i];
+		return value;
+	}
+
+	Writer::Writer() : format(1), division(DEFAULT_DIVISION), tempo(DEFAULT_TEMPO), trackCount(0), inTrack(false),
+		lastTick(0), runningStatus(0)
+	{
+		buffer.reserve(WRITE_SIZE + 1024);
+	}
+
+	Writer::~Writer()
+	{
+		close();
+	}
+
+	void Writer::open(const std::string& path, unsigned short format, unsigned short division, unsigned int tempo)
+	{
+		close();
+
+		if (format > 1)
+			throw RtMidiError("MidiFile::Writer::open: only formats 0 and 1 are supported.", RtMidiError::INVALID_PARAMETER);
+		if (division == 0 || (division & 0x8000) || tempo == 0 || tempo > 0xFFFFFF)
+			throw RtMidiError("MidiFile::Writer::open: the division or the tempo is invalid.", RtMidiError::INVALID_PARAMETER);
+
+		file.open(path, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			throw RtMidiError("MidiFile::Writer::open: the file " + path + " cannot be created.", RtMidiError::INVALID_PARAMETER);
+
+		this->format = format;
+		this->division = division;
+		this->tempo = tempo;
+		trackCount = 0;
+
+		//The number of tracks is written by close()
+		unsigned char header[14] = { HEADER_CHUNK[0], HEADER_CHUNK[1], HEADER_CHUNK[2], HEADER_CHUNK[3] };
+		putBigEndian(header + 4, HEADER_LENGTH, 4);
+		putBigEndian(header + 8, format, 2);
+		putBigEndian(header + 10, 0, 2);
+		putBigEndian(header + 12, division, 2);
+		file.write((const char*)header, sizeof(header));
+	}
+
+	void Writer::close()
+	{
+		if (!file.is_open())
+			return;
+
+		//A file has at least one track
+		if (trackCount == 0)
+			beginTrack();
+		if (inTrack)
+			endTrack();
+
+		unsigned char count[2];
+		putBigEndian(count, trackCount, 2);
+		file.seekp(10);
+		file.write((const char*)count, 2);
+		file.close();
+	}
+
+	void Writer::beginTrack()
+	{
+		if (inTrack)
+			endTrack();
+		if (format == 0 && trackCount == 1)
+			throw RtMidiError("MidiFile::Writer::beginTrack: a format 0 file has a single track.", RtMidiError::INVALID_USE);
+
+		//The length is written by endTrack()
+		trackStart = file.tellp();
+		unsigned char header[8] = { TRACK_CHUNK[0], TRACK_CHUNK[1], TRACK_CHUNK[2], TRACK_CHUNK[3], 0, 0, 0, 0 };
+		file.write((const char*)header, sizeof(header));
+
+		inTrack = true;
+		lastTick = 0;
+		runningStatus = 0;
+		if (trackCount++ == 0)
+		{
+			unsigned char tempoEvent[7] = { 0x00, META_EVENT, META_TEMPO, 0x03 };
+			putBigEndian(tempoEvent + 4, tempo, 3);
+			buffer.insert(buffer.end(), tempoEvent, tempoEvent + sizeof(tempoEvent));
+		}
+	}
+
+	void Writer::write(long long time, const unsigned char* bytes, size_t size)
+	{
+		if (size == 0)
+			return;
+		if (!inTrack)
+			beginTrack();
+
+		//Rounded to the nearest tick, from the start of the file, so that rounding errors do not add up
+		unsigned long long tick = time > 0 ? ((unsigned long long)time * division + tempo * 500ULL) / (tempo * 1000ULL) : 0;
+		if (tick < lastTick)
+			tick = lastTick;
+		writeQuantity(tick - lastTick);
+		lastTick = tick;
+
+		unsigned char status = bytes[0];
+		if (status == 0xF0)
+		{
+			buffer.push_back(0xF0);
+			writeQuantity(size - 1);
+			buffer.insert(buffer.end(), bytes + 1, bytes + size);
+			runningStatus = 0;
+		}
+		else if (status >= 0x80 && status < 0xF0)
+		{
+			if (status != runningStatus)
+				buffer.push_back(status);
+			runningStatus = status;
+			size_t messageSize = (std::min)(size, (size_t)MidiCapture::messageSize(status));
+			buffer.insert(buffer.end(), bytes + 1, bytes + messageSize);
+		}
+		else
+		{
+			buffer.push_back(ESCAPE_EVENT);
+			writeQuantity(size);
+			buffer.insert(buffer.end(), bytes, bytes + size);
+			runningStatus = 0;
+		}
+
+		if (buffer.size() >= WRITE_SIZE)
+			flushBuffer();
+	}
+
+	void Writer::endTrack()
+	{
+		if (!inTrack)
+			return;
+
+		unsigned char endOfTrack[4] = { 0x00, META_EVENT, META_END_OF_TRACK, 0x00 };
+		buffer.insert(buffer.end(), endOfTrack, endOfTrack + sizeof(endOfTrack));
+		flushBuffer();
+
+		std::streampos end = file.tellp();
+		unsigned char length[4];
+		putBigEndian(length, (unsigned int)(end - trackStart - 8), 4);
+		file.seekp(trackStart + (std::streamoff)4);
+		file.write((const char*)length, 4);
+		file.seekp(end);
+		inTrack = false;
+	}
+
+	void Writer::writeQuantity(unsigned long long value)
+	{
+		unsigned char bytes[10];
+		int count = 0;
+		do
+		{
+			bytes[count++] = (unsigned char)(value & 0x7F);
+			value >>= 7;
+		} while (value != 0);
+		while (count > 1)
+			buffer.push_back(bytes[--count] | 0x80);
+		buffer.push_back(bytes[0]);
+	}
+
+	void Writer::flushBuffer()
+	{
+		file.write((const char*)buffer.data(), buffer.size());
+		buffer.clear();
+	}
+
+	Reader::Reader() : lastTrack(nullptr), division(DEFAULT_DIVISION), tempo(DEFAULT_TEMPO), tempoTick(0), tempoTime(0)
+	{
+	}
+
+	Reader::~Reader()
+	{
+		close();
+	}
+
+	void Reader::open(const std::string& path)
+	{
+		close();
+
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open())
+			throw RtMidiError("MidiFile::Reader::open: the file " + path + " cannot be opened.", RtMidiError::INVALID_PARAMETER);
+
+		unsigned char header[14];
+		if (!file.read((char*)header, sizeof(header)) || !std::equal(HEADER_CHUNK, HEADER_CHUNK + 4, header)
+			|| getBigEndian(header + 4, 4) < HEADER_LENGTH)
+			throw RtMidiError("MidiFile::Reader::open: " + path + " is not a Standard MIDI File.", RtMidiError::INVALID_PARAMETER);
+		if (getBigEndian(header + 8, 2) > 1)
+			throw RtMidiError("MidiFile::Reader::open: only formats 0 and 1 are supported.", RtMidiError::INVALID_PARAMETER);
+		division = (unsigned short)getBigEndian(header + 12, 2);
+		if (division == 0)
+			throw RtMidiError("MidiFile::Reader::open: the division of " + path + " is invalid.", RtMidiError::INVALID_PARAMETER);
+		file.seekg(8 + getBigEndian(header + 4, 4));
+
+		//Each track gets a stream positioned at its first event. Chunks of other types are skipped.
+		unsigned char chunk[8];
+		while (file.read((char*)chunk, sizeof(chunk)))
+		{
+			unsigned int length = getBigEndian(chunk + 4, 4);
+			std::streampos start = file.tellg();
+			if (std::equal(TRACK_CHUNK, TRACK_CHUNK + 4, chunk))
+			{
+				Track* track = new Track;
+				tracks.push_back(track);
+				track->file.open(path, std::ios::binary);
+				track->file.seekg(start);
+				track->remaining = length;
+				track->tick = 0;
+				track->runningStatus = 0;
+				track->tempo = 0;
+				track->messageStart = 0;
+				track->messageSize = 0;
+				track->bytes.reserve(256);
+				readEvent(*track);
+			}
+			file.seekg(start + (std::streamoff)length);
+		}
+
+		tempo = DEFAULT_TEMPO;
+		tempoTick = 0;
+		tempoTime = 0;
+		lastTrack = nullptr;
+	}
+
+	void Reader::close()
+	{
+		for (size_t i = 0; i < tracks.size(); i++)
+			delete tracks[i];
+		tracks.clear();
+		lastTrack = nullptr;
+	}
+
+	bool Reader::next(MidiCapture::Message& message)
+	{
+		if (lastTrack != nullptr)
+		{
+			//The next message of an escape event comes at the same tick
+			if (!nextEscapedMessage(*lastTrack))
+				readEvent(*lastTrack);
+			lastTrack = nullptr;
+		}
+
+		while (true)
+		{
+			//k-way merge: the track whose next event is the earliest, the first one on ties
+			Track* earliest = nullptr;
+			for (size_t i = 0; i < tracks.size(); i++)
+			{
+				if (tracks[i]->pending && (earliest == nullptr || tracks[i]->tick < earliest->tick))
+					earliest = tracks[i];
+			}
+			if (earliest == nullptr)
+				return false;
+
+			if (earliest->type == TEMPO)
+			{
+				tempoTime = tickTime(earliest->tick);
+				tempoTick = earliest->tick;
+				tempo = earliest->tempo;
+				readEvent(*earliest);
+				continue;
+			}
+
+			message.time = tickTime(earliest->tick);
+			message.bytes = earliest->bytes.data() + earliest->messageStart;
+			message.size = earliest->messageSize;
+			lastTrack = earliest;
+			return true;
+		}
+	}
+
+	long long Reader::startTime() const
+	{
+		return 0;
+	}
+
+	unsigned short Reader::trackCount() const
+	{
+		return (unsigned short)tracks.size();
+	}
+
+	int Reader::readByte(Track& track)
+	{
+		if (track.remaining == 0)
+			return -1;
+		track.remaining--;
+		int byte = track.file.get();
+		return byte == std::char_traits<char>::eof() ? -1 : byte;
+	}
+
+	bool Reader::readBytes(Track& track, unsigned char* bytes, unsigned int size)
+	{
+		if (size > track.remaining)
+			return false;
+		track.remaining -= size;
+		return (bool)track.file.read((char*)bytes, size);
+	}
+
+	bool Reader::readQuantity(Track& track, unsigned int& value)
+	{
+		value = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			int byte = readByte(track);
+			if (byte < 0)
+				return false;
+			value = (value << 7) | (byte & 0x7F);
+			if (!(byte & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	bool Reader::readEvent(Track& track)
+	{
+		track.pending = false;
+		while (true)
+		{
+			unsigned int delta;
+			if (!readQuantity(track, delta))
+				return false;
+			track.tick += delta;
+
+			int status = readByte(track);
+			if (status < 0)
+				return false;
+
+			if (status == META_EVENT)
+			{
+				int type = readByte(track);
+				unsigned int length;
+				if (type < 0 || !readQuantity(track, length) || type == META_END_OF_TRACK)
+					return false;
+				if (type == META_TEMPO && length == 3)
+				{
+					unsigned char value[3];
+					if (!readBytes(track, value, 3))
+						return false;
+					track.type = TEMPO;
+					track.tempo = getBigEndian(value, 3);
+					return track.pending = true;
+				}
+				if (length > track.remaining)
+					return false;
+				track.remaining -= length;
+				track.file.ignore(length);
+				continue;
+			}
+
+			if (status == 0xF0 || status == ESCAPE_EVENT)
+			{
+				unsigned int length;
+				if (!readQuantity(track, length) || length > track.remaining || length > MidiCapture::MAX_SYSEX_SIZE)
+					return false;
+				size_t offset = status == 0xF0 ? 1 : 0;
+				track.bytes.resize(offset + length);
+				if (offset != 0)
+					track.bytes[0] = 0xF0;
+				if (!readBytes(track, track.bytes.data() + offset, length))
+					return false;
+				track.runningStatus = 0;
+				track.type = MESSAGE;
+				if (status == 0xF0)
+				{
+					track.messageStart = 0;
+					track.messageSize = track.bytes.size();
+					return track.pending = true;
+				}
+				//Escape events continuing a SysEx split in several events hold no message and
+				//are not played
+				track.messageStart = 0;
+				track.messageSize = 0;
+				if (!nextEscapedMessage(track))
+					continue;
+				return track.pending = true;
+			}
+
+			unsigned char data = 0;
+			bool hasData = false;
+			if (!(status & 0x80))
+			{
+				if (track.runningStatus == 0)
+					return false;
+				data = (unsigned char)status;
+				hasData = true;
+				status = track.runningStatus;
+			}
+			else if (status < 0xF0)
+				track.runningStatus = (unsigned char)status;
+
+			unsigned int size = MidiCapture::messageSize((unsigned char)status);
+			track.messageStart = 0;
+			track.messageSize = size;
+			track.bytes.resize(size);
+			track.bytes[0] = (unsigned char)status;
+			if (size > 1)
+			{
+				if (hasData)
+					track.bytes[1] = data;
+				unsigned int first = hasData ? 2 : 1;
+				if (!readBytes(track, track.bytes.data() + first, size - first))
+					return false;
+			}
+			track.type = MESSAGE;
+			return track.pending = true;
+		}
+	}
+
+	//Moves to the message following the current one in the bytes of an escape event. Data bytes
+	//without a status are skipped. Returns false if there is none.
+	bool Reader::nextEscapedMessage(Track& track)
+	{
+		size_t start = track.messageStart + track.messageSize;
+		while (start < track.bytes.size() && !MidiCapture::isStatus(track.bytes[start]))
+			start++;
+		if (start >= track.bytes.size())
+			return false;
+
+		size_t size;
+		if (track.bytes[start] == 0xF0)
+		{
+			//Up to and including F7h
+			const unsigned char* end = std::find(track.bytes.data() + start, track.bytes.data() + track.bytes.size(), 0xF7);
+			size = end - (track.bytes.data() + start) + (end != track.bytes.data() + track.bytes.size() ? 1 : 0);
+		}
+		else
+		{
+			//A message cut by the end of the event is not played
+			size = MidiCapture::messageSize(track.bytes[start]);
+			if (size > track.bytes.size() - start)
+				return false;
+		}
+		track.messageStart = start;
+		track.messageSize = size;
+		return true;
+	}
+
+	long long Reader::tickTime(unsigned long long tick) const
+	{
+		if (division & 0x8000)
+		{
+			//SMPTE: -frames per second in the high byte, ticks per frame in the low byte.
+			//29 stands for 29.97 frames per second.
+			long long framesPerSecond = -(signed char)(division >> 8);
+			long long ticksPerFrame = division & 0xFF;
+			if (framesPerSecond == 29)
+				return (long long)(tick * 100000000000ULL / (2997 * ticksPerFrame));
+			return (long long)(tick * 1000000000ULL / (framesPerSecond * ticksPerFrame));
+		}
+		return tempoTime + (long long)((tick - tempoTick) * tempo * 1000ULL / division);
+	}
+
+	void exportCapture(const std::string& capturePath, const std::string& midiPath, unsigned short format)
+	{
+		MidiCapture::Reader capture;
+		capture.open(capturePath);
+		Writer writer;
+		writer.open(midiPath, format);
+
+		MidiCapture::Message message;
+		if (format == 0)
+		{
+			writer.beginTrack();
+			while (capture.next(message))
+				writer.write(message.time - capture.startTime(), message.bytes, message.size);
+			writer.close();
+			return;
+		}
+
+		//First track: the system messages. The channels used are found at the same time.
+		unsigned int channels = 0;
+		writer.beginTrack();
+		while (capture.next(message))
+		{
+			if (message.bytes[0] >= 0xF0)
+				writer.write(message.time - capture.startTime(), message.bytes, message.size);
+			else
+				channels |= 1 << (message.bytes[0] & 0x0F);
+		}
+
+		for (unsigned char channel = 0; channel < 16; channel++)
+		{
+			if (!(channels & (1 << channel)))
+				continue;
+			capture.open(capturePath);
+			writer.beginTrack();
+			while (capture.next(message))
+			{
+				if (message.bytes[0] < 0xF0 && (message.bytes[0] & 0x0F) == channel)
+					writer.write(message.time - capture.startTime(), message.bytes, message.size);
+			}
+		}
+		writer.close();
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include "MidiCapture.h"
+
+//Standard MIDI Files (SMF), format 0 and 1, written and read as streams: a file of any length
+//is written or read with a fixed amount of memory, a few buffers per track.
+//
+//Times are nanoseconds, as in capture files. They are converted to and from ticks with the
+//division of the file and its tempo map. Messages which have no place in a track (system
+//common and real-time messages) are written as F7h escape events, and read back as sent. An
+//escape event holding several messages is read as one message after the other.
+//
+//	MidiFile::exportCapture("show.lcap", "show.mid");
+//	MidiReplay::addPort("Launch Control (replay)", "show.mid"); // MidiCapture::openSource
+namespace MidiFile
+{
+	//Ticks per quarter note, and microseconds per quarter note (120 bpm): 1 tick is 0.52 ms.
+	const unsigned short DEFAULT_DIVISION = 960;
+	const unsigned int DEFAULT_TEMPO = 500000;
+
+	//Writes the tracks one after the other. The length of each track is written in its header
+	//by endTrack(), and the number of tracks by close(), so nothing is kept in memory.
+	class Writer
+	{
+	public:
+		Writer();
+		~Writer();
+
+		//Creates a format 0 (a single track) or format 1 file. The tempo is set at the start of
+		//the first track. Throws an RtMidiError if the file cannot be created.
+		void open(const std::string& path, unsigned short format = 1, unsigned short division = DEFAULT_DIVISION, unsigned int tempo = DEFAULT_TEMPO);
+		//Ends the current track, if any, and completes the header.
+		void close();
+
+		void beginTrack();
+		//Appends a message at time nanoseconds from the start of the file. The times of a track
+		//must not decrease.
+		void write(long long time, const unsigned char* bytes, size_t size);
+		void endTrack();
+
+	private:
+		std::ofstream file;
+		unsigned short format;
+		unsigned short division;
+		unsigned int tempo;
+		unsigned short trackCount;
+		bool inTrack;
+		std::streampos trackStart;
+		unsigned long long lastTick;
+		unsigned char runningStatus;
+		std::vector<unsigned char> buffer;
+
+		void writeQuantity(unsigned long long value);
+		void flushBuffer();
+	};
+
+	//Reads the messages of all the tracks in time order. Format 1 tracks are merged as the file
+	//is read: each track is read through a stream of its own, and the earliest of their next
+	//events is returned, the first track winning ties, so that tempo changes apply in order.
+	class Reader : public MidiCapture::Source
+	{
+	public:
+		Reader();
+		~Reader();
+
+		//Throws an RtMidiError if the file cannot be opened or is not a Standard MIDI File.
+		void open(const std::string& path);
+		void close();
+
+		bool next(MidiCapture::Message& message);
+
+		//The times start at 0.
+		long long startTime() const;
+
+		unsigned short trackCount() const;
+
+	private:
+		enum EventType : unsigned char
+		{
+			MESSAGE,
+			TEMPO
+		};
+
+		struct Track
+		{
+			std::ifstream file;
+			//Bytes of the track not read yet
+			unsigned int remaining;
+			unsigned long long tick;
+			unsigned char runningStatus;
+			//Next event of the track, read ahead to merge the tracks
+			bool pending;
+			EventType type;
+			unsigned int tempo;
+			std::vector<unsigned char> bytes;
+			//Message of the event within bytes, the event being an escape event when start is
+			//not 0 or size is not bytes.size()
+			size_t messageStart;
+			size_t messageSize;
+		};
+
+		std::vector<Track*> tracks;
+		//Track of the message last returned, whose next event is read by the next call, as the
+		//message is in the buffer of the track.
+		Track* lastTrack;
+		unsigned short division;
+
+		//Tempo map: time and tick of the last tempo change
+		unsigned int tempo;
+		unsigned long long tempoTick;
+		long long tempoTime;
+
+		bool readEvent(Track& track);
+		static bool nextEscapedMessage(Track& track);
+		static int readByte(Track& track);
+		static bool readBytes(Track& track, unsigned char* bytes, unsigned int size);
+		static bool readQuantity(Track& track, unsigned int& value);
+		long long tickTime(unsigned long long tick) const;
+	};
+
+	//Converts a capture file (see MidiCapture.h) to a Standard MIDI File. A format 1 file has a
+	//track for the system messages and the tempo, then one track per MIDI channel used: the
+	//capture is read once per track, so its length does not matter.
+	void exportCapture(const std::string& capturePath, const std::string& midiPath, unsigned short format = 1);
+}
@@ -1,6 +1,8 @@
+#if defined(_MSC_VER)
 #define _CRTDBG_MAP_ALLOC
 #include <stdlib.h>
 #include <crtdbg.h>
+#endif
 
 /**********************************************************************/
 /*! \class RtMidi
@@ -41,7 +43,9 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 /**********************************************************************/
 
 #include "RtMidi.h"
+#include "MidiCapture.h"
 #include <sstream>
+#include <thread>
 
 #if defined(__MACOSX_CORE__)
 #if TARGET_OS_IPHONE
@@ -89,6 +93,11 @@ void RtMidi::getCompiledApi(std::vector<RtMidi::Api> &apis) throw()
 #if defined(__WINDOWS_MM__)
 	apis.push_back(WINDOWS_MM);
 #endif
+#if defined(__LINUX_FD__)
+	apis.push_back(LINUX_FD);
+#endif
+	apis.push_back(RTMIDI_LOOPBACK);
+	apis.push_back(RTMIDI_REPLAY);
 #if defined(__RTMIDI_DUMMY__)
 	apis.push_back(RTMIDI_DUMMY);
 #endif
@@ -120,6 +129,14 @@ void RtMidiIn::openMidiApi(RtMidi::Api api, const std::string clientName, unsign
 	if (api == MACOSX_CORE)
 		rtapi_ = new MidiInCore(clientName, queueSizeLimit);
 #endif
+#if defined(__LINUX_FD__)
+	if (api == LINUX_FD)
+		rtapi_ = new MidiInFd(clientName, queueSizeLimit);
+#endif
+	if (api == RTMIDI_LOOPBACK)
+		rtapi_ = new MidiInLoopback(clientName, queueSizeLimit);
+	if (api == RTMIDI_REPLAY)
+		rtapi_ = new MidiInReplay(clientName, queueSizeLimit);
 #if defined(__RTMIDI_DUMMY__)
 	if (api == RTMIDI_DUMMY)
 		rtapi_ = new MidiInDummy(clientName, queueSizeLimit);
@@ -189,6 +206,14 @@ void RtMidiOut::openMidiApi(RtMidi::Api api, const std::string clientName)
 	if (api == MACOSX_CORE)
 		rtapi_ = new MidiOutCore(clientName);
 #endif
+#if defined(__LINUX_FD__)
+	if (api == LINUX_FD)
+		rtapi_ = new MidiOutFd(clientName);
+#endif
+	if (api == RTMIDI_LOOPBACK)
+		rtapi_ = new MidiOutLoopback(clientName);
+	if (api == RTMIDI_REPLAY)
+		rtapi_ = new MidiOutReplay(clientName);
 #if defined(__RTMIDI_DUMMY__)
 	if (api == RTMIDI_DUMMY)
 		rtapi_ = new MidiOutDummy(clientName);
@@ -286,15 +311,11 @@ MidiInApi::MidiInApi(unsigned int queueSizeLimit)
 	: MidiApi()
 {
 	// Allocate the MIDI queue.
-	inputData_.queue.ringSize = queueSizeLimit;
-	if (inputData_.queue.ringSize > 0)
-		inputData_.queue.ring = new MidiMessage[inputData_.queue.ringSize];
+	inputData_.queue.resize(queueSizeLimit);
 }
 
 MidiInApi :: ~MidiInApi(void)
 {
-	// Delete the MIDI queue.
-	if (inputData_.queue.ringSize > 0) delete[] inputData_.queue.ring;
 }
 
 void MidiInApi::setCallback(RtMidiCallback callback, void *userData)
@@ -316,6 +337,22 @@ void MidiInApi::setCallback(RtMidiCallback callback, void *userData)
 	inputData_.usingCallback = true;
 }
 
+void MidiInApi::setSysExCallback(RtMidiSysExCallback callback, void *userData)
+{
+	inputData_.sysexCallback = callback;
+	inputData_.sysexUserData = userData;
+}
+
+void MidiInApi::setCapture(MidiCapture::Writer *capture)
+{
+	// Both the pointer and the count are sequentially consistent: a dispatch
+	// either sees the new writer, or is counted here until it is done with
+	// the previous one.
+	inputData_.capture.store(capture);
+	while (inputData_.captureUsers.load() != 0)
+		std::this_thread::yield();
+}
+
 void MidiInApi::cancelCallback()
 {
 	if (!inputData_.usingCallback) {
@@ -347,27 +384,140 @@ double MidiInApi::getMessage(std::vector<unsigned char> *message)
 		return 0.0;
 	}
 
-	if (inputData_.queue.size == 0) return 0.0;
+	// Copy the bytes straight from the queue slot and then "pop" it.
+	const RtMidiEvent *event = inputData_.queue.readSlot();
+	if (!event) return 0.0;
 
-	// Copy queued message to the vector pointer argument and then "pop" it.
-	std::vector<unsigned char> *bytes = &(inputData_.queue.ring[inputData_.queue.front].bytes);
-	message->assign(bytes->begin(), bytes->end());
-	double deltaTime = inputData_.queue.ring[inputData_.queue.front].timeStamp;
-	inputData_.queue.size--;
-	inputData_.queue.front++;
-	if (inputData_.queue.front == inputData_.queue.ringSize)
-		inputData_.queue.front = 0;
+	for (unsigned int i = 0; i < event->size(); i++)
+		message->push_back((*event)[i]);
+	double deltaTime = event->timeStamp;
+	inputData_.queue.commitRead();
 
 	return deltaTime;
 }
 
+bool MidiInApi::getEvent(RtMidiEvent &event)
+{
+	if (inputData_.usingCallback) {
+		errorString_ = "RtMidiIn::getEvent: a user callback is currently set for this port.";
+		error(RtMidiError::WARNING, errorString_);
+		return false;
+	}
+
+	return inputData_.queue.pop(event);
+}
+
+unsigned int MidiInApi::getMessages(RtMidiEvent *events, unsigned int maxEvents)
+{
+	if (inputData_.usingCallback) {
+		errorString_ = "RtMidiIn::getMessages: a user callback is currently set for this port.";
+		error(RtMidiError::WARNING, errorString_);
+		return 0;
+	}
+
+	return inputData_.queue.popBatch(events, maxEvents);
+}
+
+RtMidiInStats MidiInApi::stats() const
+{
+	const RtMidiInData::Counters &counters = inputData_.counters;
+	RtMidiInStats stats;
+	for (int i = 0; i < 7; i++)
+		stats.channelMessages[i] = counters.channelMessages[i].load(std::memory_order_relaxed);
+	stats.systemMessages = counters.systemMessages.load(std::memory_order_relaxed);
+	stats.sysexMessages = counters.sysexMessages.load(std::memory_order_relaxed);
+	stats.sysexBytes = counters.sysexBytes.load(std::memory_order_relaxed);
+	stats.droppedMessages = counters.droppedMessages.load(std::memory_order_relaxed);
+	stats.queueHighWater = counters.queueHighWater.load(std::memory_order_relaxed);
+	return stats;
+}
+
+// The input counters have a single writer, so a relaxed load and store
+// is enough, without the cost of a locked increment.  Returns the
+// previous value.
+template <typename T>
+static inline T addToCounter(std::atomic<T> &counter, T amount)
+{
+	T value = counter.load(std::memory_order_relaxed);
+	counter.store(value + amount, std::memory_order_relaxed);
+	return value;
+}
+
+void MidiInApi::dispatchEvent(RtMidiInData *data, const RtMidiEvent &event)
+{
+	unsigned char status = event.status();
+	if (status >= 0x80 && status < 0xF0)
+		addToCounter(data->counters.channelMessages[(status >> 4) - 8], 1ULL);
+	else
+		addToCounter(data->counters.systemMessages, 1ULL);
+
+	if (data->capture.load(std::memory_order_relaxed)) {
+		data->captureUsers.fetch_add(1);
+		MidiCapture::Writer *capture = data->capture.load();
+		if (capture) capture->capture(event);
+		data->captureUsers.fetch_sub(1, std::memory_order_release);
+	}
+
+	if (data->usingCallback) {
+		data->userCallback(event, data->userData);
+		return;
+	}
+
+	// As long as we haven't reached our queue size limit, push the message.
+	// Only the first drop is reported, the others are counted.
+	if (!data->queue.push(event)) {
+		if (addToCounter(data->counters.droppedMessages, 1ULL) == 0)
+			std::cerr << "\nRtMidiIn: message queue limit reached!! (further drops are counted by RtMidiIn::stats)\n\n";
+		return;
+	}
+	unsigned int queued = data->queue.size();
+	if (queued > data->counters.queueHighWater.load(std::memory_order_relaxed))
+		data->counters.queueHighWater.store(queued, std::memory_order_relaxed);
+}
+
+void MidiInApi::dispatchSysEx(RtMidiInData *data, double timeStamp, long long arrivalTime, const unsigned char *bytes, size_t nBytes)
+{
+	addToCounter(data->counters.sysexMessages, 1ULL);
+	addToCounter(data->counters.sysexBytes, (unsigned long long)nBytes);
+
+	if (data->capture.load(std::memory_order_relaxed)) {
+		data->captureUsers.fetch_add(1);
+		MidiCapture::Writer *capture = data->capture.load();
+		if (capture) capture->captureSysEx(arrivalTime, bytes, nBytes);
+		data->captureUsers.fetch_sub(1, std::memory_order_release);
+	}
+
+	if (data->sysexCallback)
+		data->sysexCallback(timeStamp, arrivalTime, bytes, nBytes, data->sysexUserData);
+}
+
 //*********************************************************************//
 //  Common MidiOutApi Definitions
 //*********************************************************************//
 
 MidiOutApi::MidiOutApi(void)
-	: MidiApi()
+	: MidiApi(), sentMessages_(0), sentBytes_(0), sentSysexMessages_(0), sentSysexBytes_(0)
+{
+}
+
+void MidiOutApi::countMessage(const unsigned char *message, size_t size)
+{
+	sentMessages_.fetch_add(1, std::memory_order_relaxed);
+	sentBytes_.fetch_add(size, std::memory_order_relaxed);
+	if (size > 0 && message[0] == 0xF0) {
+		sentSysexMessages_.fetch_add(1, std::memory_order_relaxed);
+		sentSysexBytes_.fetch_add(size, std::memory_order_relaxed);
+	}
+}
+
+RtMidiOutStats MidiOutApi::stats() const
 {
+	RtMidiOutStats stats;
+	stats.messages = sentMessages_.load(std::memory_order_relaxed);
+	stats.bytes = sentBytes_.load(std::memory_order_relaxed);
+	stats.sysexMessages = sentSysexMessages_.load(std::memory_order_relaxed);
+	stats.sysexBytes = sentSysexBytes_.load(std::memory_order_relaxed);
+	return stats;
 }
 
 MidiOutApi :: ~MidiOutApi(void)
@@ -382,6 +532,8 @@ MidiOutApi :: ~MidiOutApi(void)
 
 
 
+#if defined(__WINDOWS_MM__)
+
 //*********************************************************************//
 //  API: Windows Multimedia Library (MM)
 //*********************************************************************//
@@ -410,7 +562,6 @@ struct WinMidiData {
 	HMIDIIN inHandle;    // Handle to Midi Input Device
 	HMIDIOUT outHandle;  // Handle to Midi Output Device
 	DWORD lastTime;
-	MidiInApi::MidiMessage message;
 	LPMIDIHDR sysexBuffer[RT_SYSEX_BUFFER_COUNT];
 	CRITICAL_SECTION _mutex; // [Patrice] see https://groups.google.com/forum/#!topic/mididev/6OUjHutMpEo
 };
@@ -432,12 +583,14 @@ static void CALLBACK midiInputCallback(HMIDIIN /*hmin*/,
 	MidiInApi::RtMidiInData *data = (MidiInApi::RtMidiInData *)instancePtr;
 	WinMidiData *apiData = static_cast<WinMidiData *> (data->apiData);
 
+	// Absolute arrival time, taken before any processing.
+	long long arrivalTime = RtMidiEvent::now();
+
 	// Calculate time stamp.
-	if (data->firstMessage == true) {
-		apiData->message.timeStamp = 0.0;
+	double timeStamp = 0.0;
+	if (data->firstMessage == true)
 		data->firstMessage = false;
-	}
-	else apiData->message.timeStamp = (double)(timestamp - apiData->lastTime) * 0.001;
+	else timeStamp = (double)(timestamp - apiData->lastTime) * 0.001;
 	apiData->lastTime = timestamp;
 
 	if (inputStatus == MIM_DATA) { // Channel or system message
@@ -466,16 +619,23 @@ static void CALLBACK midiInputCallback(HMIDIIN /*hmin*/,
 			return;
 		}
 
-		// Copy bytes to our MIDI message.
-		unsigned char *ptr = (unsigned char *)&midiMessage;
-		for (int i = 0; i<nBytes; ++i) apiData->message.bytes.push_back(*ptr++);
+		// The message bytes are packed in the low bytes of midiMessage,
+		// status first.
+		RtMidiEvent event;
+		event.packet = ((unsigned int)nBytes << 24) | ((unsigned int)status << 16);
+		if (nBytes > 1) event.packet |= (unsigned int)((midiMessage >> 8) & 0xFF) << 8;
+		if (nBytes > 2) event.packet |= (unsigned int)((midiMessage >> 16) & 0xFF);
+		event.timeStamp = timeStamp;
+		event.arrivalTime = arrivalTime;
+
+		MidiInApi::dispatchEvent(data, event);
 	}
 	else { // Sysex message ( MIM_LONGDATA or MIM_LONGERROR )
 		MIDIHDR *sysex = (MIDIHDR *)midiMessage;
-		if (!(data->ignoreFlags & 0x01) && inputStatus != MIM_LONGERROR) {
-			// Sysex message and we're not ignoring it
-			for (int i = 0; i<(int)sysex->dwBytesRecorded; ++i)
-				apiData->message.bytes.push_back(sysex->lpData[i]);
+		if (!(data->ignoreFlags & 0x01) && inputStatus != MIM_LONGERROR && sysex->dwBytesRecorded > 0) {
+			// Sysex message and we're not ignoring it. It is delivered
+			// straight from the driver buffer, before it is requeued.
+			MidiInApi::dispatchSysEx(data, timeStamp, arrivalTime, (const unsigned char *)sysex->lpData, sysex->dwBytesRecorded);
 		}
 
 		// The WinMM API requires that the sysex buffer be requeued after
@@ -493,30 +653,8 @@ static void CALLBACK midiInputCallback(HMIDIIN /*hmin*/,
 			LeaveCriticalSection(&(apiData->_mutex));
 			if (result != MMSYSERR_NOERROR)
 				std::cerr << "\nRtMidiIn::midiInputCallback: error sending sysex to Midi device!!\n\n";
-
-			if (data->ignoreFlags & 0x01) return;
-		}
-		else return;
-	}
-
-	if (data->usingCallback) {
-		//RtMidiCallback callback = static_cast<RtMidiCallback>(data->userCallback);
-		data->userCallback(apiData->message.timeStamp, &apiData->message.bytes, data->userData);
-	}
-	else {
-		// As long as we haven't reached our queue size limit, push the message.
-		if (data->queue.size < data->queue.ringSize) {
-			data->queue.ring[data->queue.back++] = apiData->message;
-			if (data->queue.back == data->queue.ringSize)
-				data->queue.back = 0;
-			data->queue.size++;
 		}
-		else
-			std::cerr << "\nRtMidiIn: message queue limit reached!!\n\n";
 	}
-
-	// Clear the vector for the next input message.
-	apiData->message.bytes.clear();
 }
 
 MidiInWinMM::MidiInWinMM(const std::string clientName, unsigned int queueSizeLimit) : MidiInApi(queueSizeLimit)
@@ -550,7 +688,6 @@ void MidiInWinMM::initialize(const std::string& /*clientName*/)
 	WinMidiData *data = (WinMidiData *) new WinMidiData;
 	apiData_ = (void *)data;
 	inputData_.apiData = (void *)data;
-	data->message.bytes.clear();  // needs to be empty for first input message
 
 	if (!InitializeCriticalSectionAndSpinCount(&(data->_mutex), 0x00000400)) {
 		errorString_ = "MidiInWinMM::initialize: InitializeCriticalSectionAndSpinCount failed.";
@@ -831,11 +968,11 @@ void MidiOutWinMM::openVirtualPort(std::string /*portName*/)
 	error(RtMidiError::WARNING, errorString_);
 }
 
-void MidiOutWinMM::sendMessage(std::vector<unsigned char> *message)
+void MidiOutWinMM::sendMessage(const unsigned char *message, size_t size)
 {
 	if (!connected_) return;
 
-	unsigned int nBytes = static_cast<unsigned int>(message->size());
+	unsigned int nBytes = static_cast<unsigned int>(size);
 	if (nBytes == 0) {
 		errorString_ = "MidiOutWinMM::sendMessage: message argument is empty!";
 		error(RtMidiError::WARNING, errorString_);
@@ -844,27 +981,16 @@ void MidiOutWinMM::sendMessage(std::vector<unsigned char> *message)
 
 	MMRESULT result;
 	WinMidiData *data = static_cast<WinMidiData *> (apiData_);
-	if (message->at(0) == 0xF0) { // Sysex message
-
-								  // Allocate buffer for sysex data.
-		char *buffer = (char *)malloc(nBytes);
-		if (buffer == NULL) {
-			errorString_ = "MidiOutWinMM::sendMessage: error allocating sysex message memory!";
-			error(RtMidiError::MEMORY_ERROR, errorString_);
-			return;
-		}
-
-		// Copy data to buffer.
-		for (unsigned int i = 0; i<nBytes; ++i) buffer[i] = message->at(i);
+	if (message[0] == 0xF0) { // Sysex message
 
-		// Create and prepare MIDIHDR structure.
+		// The driver reads the caller's buffer directly, it is not written to.
+		// The buffer stays valid as the header is unprepared before returning.
 		MIDIHDR sysex;
-		sysex.lpData = (LPSTR)buffer;
+		sysex.lpData = (LPSTR)message;
 		sysex.dwBufferLength = nBytes;
 		sysex.dwFlags = 0;
 		result = midiOutPrepareHeader(data->outHandle, &sysex, sizeof(MIDIHDR));
 		if (result != MMSYSERR_NOERROR) {
-			free(buffer);
 			errorString_ = "MidiOutWinMM::sendMessage: error preparing sysex header.";
 			error(RtMidiError::DRIVER_ERROR, errorString_);
 			return;
@@ -873,7 +999,7 @@ void MidiOutWinMM::sendMessage(std::vector<unsigned char> *message)
 		// Send the message.
 		result = midiOutLongMsg(data->outHandle, &sysex, sizeof(MIDIHDR));
 		if (result != MMSYSERR_NOERROR) {
-			free(buffer);
+			midiOutUnprepareHeader(data->outHandle, &sysex, sizeof(MIDIHDR));
 			errorString_ = "MidiOutWinMM::sendMessage: error sending sysex message.";
 			error(RtMidiError::DRIVER_ERROR, errorString_);
 			return;
@@ -881,7 +1007,6 @@ void MidiOutWinMM::sendMessage(std::vector<unsigned char> *message)
 
 		// Unprepare the buffer and MIDIHDR.
 		while (MIDIERR_STILLPLAYING == midiOutUnprepareHeader(data->outHandle, &sysex, sizeof(MIDIHDR))) Sleep(1);
-		free(buffer);
 	}
 	else { // Channel or system message.
 
@@ -893,10 +1018,10 @@ void MidiOutWinMM::sendMessage(std::vector<unsigned char> *message)
 		}
 
 		// Pack MIDI bytes into double word.
-		DWORD packet;
+		DWORD packet = 0;
 		unsigned char *ptr = (unsigned char *)&packet;
 		for (unsigned int i = 0; i<nBytes; ++i) {
-			*ptr = message->at(i);
+			*ptr = message[i];
 			++ptr;
 		}
 
@@ -908,3 +1033,1154 @@ void MidiOutWinMM::sendMessage(std::vector<unsigned char> *message)
 		}
 	}
 }
+
+#endif  // __WINDOWS_MM__
+
+
+//*********************************************************************//
+//  API: Loopback
+//*********************************************************************//
+
+// In-process ports connecting MidiOutLoopback to MidiInLoopback.  A
+// message sent to a port is parsed and dispatched synchronously, on
+// the sending thread, to each input opened on that port, exactly as a
+// driver callback would do.
+//
+// No lock is held while an input callback runs, since the callback
+// may take locks of its own which another thread holds while sending
+// to the same port.  An input is dispatched to by one sender at a
+// time, as a driver thread would be the only one: a sender finding it
+// busy leaves its message to the sender dispatching, instead of
+// waiting for it.
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+struct LoopbackPort {
+	std::string name;
+	// Replaced, never changed, when an input is opened or closed, so
+	// that senders can use it without the mutex.
+	std::shared_ptr<const std::vector<MidiInApi::RtMidiInData *> > inputs;
+	std::mutex mutex;
+};
+
+// Ports are never removed, so the pointers stay valid.
+static std::vector<LoopbackPort *> loopbackPorts;
+static std::mutex loopbackPortsMutex;
+
+static LoopbackPort *getLoopbackPort(unsigned int portNumber)
+{
+	std::lock_guard<std::mutex> lock(loopbackPortsMutex);
+	if (portNumber >= loopbackPorts.size()) return 0;
+	return loopbackPorts[portNumber];
+}
+
+// A structure to hold the state of a loopback input.
+struct LoopbackInData {
+	LoopbackPort *port;
+	long long lastTime;
+	// Senders which took this input from port->inputs, counted under
+	// port->mutex.  closePort waits for them once the input is removed.
+	std::atomic<unsigned int> senders;
+	// Set by the sender dispatching to this input.  The messages of the
+	// others are appended to pending (time, size and bytes), which the
+	// dispatching sender empties before leaving.  batch holds the
+	// messages being dispatched, and keeps its capacity.
+	std::atomic<bool> dispatching;
+	std::atomic<bool> hasPending;
+	std::mutex pendingMutex;
+	std::vector<unsigned char> pending;
+	std::vector<unsigned char> batch;
+
+	LoopbackInData() : port(0), lastTime(0), senders(0), dispatching(false), hasPending(false) {}
+};
+
+static void loopbackInput(MidiInApi::RtMidiInData *data, const unsigned char *bytes, size_t nBytes, long long arrivalTime)
+{
+	LoopbackInData *apiData = static_cast<LoopbackInData *> (data->apiData);
+
+	// Calculate time stamp.
+	double timeStamp = 0.0;
+	if (data->firstMessage == true)
+		data->firstMessage = false;
+	else timeStamp = (double)(arrivalTime - apiData->lastTime) * 0.000000001;
+	apiData->lastTime = arrivalTime;
+
+	unsigned char status = bytes[0];
+	if (status == 0xF0) {
+		if (!(data->ignoreFlags & 0x01))
+			MidiInApi::dispatchSysEx(data, timeStamp, arrivalTime, bytes, nBytes);
+		return;
+	}
+
+	if ((status == 0xF1 || status == 0xF8) && (data->ignoreFlags & 0x02)) return;
+	if (status == 0xFE && (data->ignoreFlags & 0x04)) return;
+
+	MidiInApi::dispatchEvent(data, RtMidiEvent::pack(bytes, nBytes < 3 ? (unsigned int)nBytes : 3, timeStamp, arrivalTime));
+}
+
+static void loopbackDefer(LoopbackInData *input, const unsigned char *bytes, size_t nBytes, long long arrivalTime)
+{
+	std::lock_guard<std::mutex> lock(input->pendingMutex);
+	size_t offset = input->pending.size();
+	input->pending.resize(offset + sizeof(arrivalTime) + sizeof(nBytes) + nBytes);
+	unsigned char *record = &input->pending[offset];
+	memcpy(record, &arrivalTime, sizeof(arrivalTime));
+	memcpy(record + sizeof(arrivalTime), &nBytes, sizeof(nBytes));
+	memcpy(record + sizeof(arrivalTime) + sizeof(nBytes), bytes, nBytes);
+	input->hasPending.store(true);
+}
+
+// Called by the sender dispatching to the input: dispatches the messages
+// left by the others, then releases the input.  A message left after the
+// last check is dispatched by taking the input again, unless another
+// sender took it first.
+static void loopbackDrain(MidiInApi::RtMidiInData *data)
+{
+	LoopbackInData *input = static_cast<LoopbackInData *> (data->apiData);
+	do {
+		while (input->hasPending.load()) {
+			{
+				std::lock_guard<std::mutex> lock(input->pendingMutex);
+				input->batch.clear();
+				input->batch.swap(input->pending);
+				input->hasPending.store(false);
+			}
+			size_t offset = 0;
+			while (offset < input->batch.size()) {
+				const unsigned char *record = &input->batch[offset];
+				long long arrivalTime;
+				size_t nBytes;
+				memcpy(&arrivalTime, record, sizeof(arrivalTime));
+				memcpy(&nBytes, record + sizeof(arrivalTime), sizeof(nBytes));
+				loopbackInput(data, record + sizeof(arrivalTime) + sizeof(nBytes), nBytes, arrivalTime);
+				offset += sizeof(arrivalTime) + sizeof(nBytes) + nBytes;
+			}
+		}
+		input->dispatching.store(false);
+	} while (input->hasPending.load() && !input->dispatching.exchange(true));
+}
+
+static void loopbackDeliver(MidiInApi::RtMidiInData *data, const unsigned char *bytes, size_t nBytes, long long arrivalTime)
+{
+	LoopbackInData *input = static_cast<LoopbackInData *> (data->apiData);
+	if (!input->dispatching.exchange(true)) {
+		// The messages left by other senders go first.
+		if (input->hasPending.load())
+			loopbackDefer(input, bytes, nBytes, arrivalTime);
+		else
+			loopbackInput(data, bytes, nBytes, arrivalTime);
+	}
+	else {
+		// Also the case of a callback sending to its own port.
+		loopbackDefer(input, bytes, nBytes, arrivalTime);
+		// The dispatching sender may have released the input before
+		// seeing the message.
+		if (input->dispatching.exchange(true)) return;
+	}
+	loopbackDrain(data);
+}
+
+unsigned int MidiLoopback::addPort(const std::string &portName)
+{
+	LoopbackPort *port = new LoopbackPort;
+	port->name = portName;
+	port->inputs = std::make_shared<std::vector<MidiInApi::RtMidiInData *> >();
+
+	std::lock_guard<std::mutex> lock(loopbackPortsMutex);
+	loopbackPorts.push_back(port);
+	return (unsigned int)loopbackPorts.size() - 1;
+}
+
+unsigned int MidiLoopback::getPortCount(void)
+{
+	std::lock_guard<std::mutex> lock(loopbackPortsMutex);
+	return (unsigned int)loopbackPorts.size();
+}
+
+std::string MidiLoopback::getPortName(unsigned int portNumber)
+{
+	LoopbackPort *port = getLoopbackPort(portNumber);
+	if (!port) return std::string();
+	return port->name;
+}
+
+//*********************************************************************//
+//  API: Loopback
+//  Class Definitions: MidiInLoopback
+//*********************************************************************//
+
+MidiInLoopback::MidiInLoopback(const std::string clientName, unsigned int queueSizeLimit) : MidiInApi(queueSizeLimit)
+{
+	initialize(clientName);
+}
+
+MidiInLoopback :: ~MidiInLoopback()
+{
+	// Close a connection if it exists.
+	closePort();
+
+	// Cleanup.
+	delete static_cast<LoopbackInData *> (apiData_);
+}
+
+void MidiInLoopback::initialize(const std::string& /*clientName*/)
+{
+	// Save our api-specific connection information.
+	LoopbackInData *data = new LoopbackInData;
+	apiData_ = (void *)data;
+	inputData_.apiData = (void *)data;
+}
+
+void MidiInLoopback::openPort(unsigned int portNumber, const std::string /*portName*/)
+{
+	if (connected_) {
+		errorString_ = "MidiInLoopback::openPort: a valid connection already exists!";
+		error(RtMidiError::WARNING, errorString_);
+		return;
+	}
+
+	LoopbackPort *port = getLoopbackPort(portNumber);
+	if (!port) {
+		std::ostringstream ost;
+		ost << "MidiInLoopback::openPort: the 'portNumber' argument (" << portNumber << ") is invalid.";
+		errorString_ = ost.str();
+		error(RtMidiError::INVALID_PARAMETER, errorString_);
+		return;
+	}
+
+	LoopbackInData *data = static_cast<LoopbackInData *> (apiData_);
+	std::lock_guard<std::mutex> lock(port->mutex);
+	data->port = port;
+	std::shared_ptr<std::vector<MidiInApi::RtMidiInData *> > inputs = std::make_shared<std::vector<MidiInApi::RtMidiInData *> >(*port->inputs);
+	inputs->push_back(&inputData_);
+	port->inputs = inputs;
+	connected_ = true;
+}
+
+void MidiInLoopback::openVirtualPort(const std::string portName)
+{
+	openPort(MidiLoopback::addPort(portName), portName);
+}
+
+void MidiInLoopback::closePort(void)
+{
+	if (connected_) {
+		LoopbackInData *data = static_cast<LoopbackInData *> (apiData_);
+		LoopbackPort *port = data->port;
+		{
+			std::lock_guard<std::mutex> lock(port->mutex);
+			std::shared_ptr<std::vector<MidiInApi::RtMidiInData *> > inputs = std::make_shared<std::vector<MidiInApi::RtMidiInData *> >(*port->inputs);
+			inputs->erase(std::remove(inputs->begin(), inputs->end(), &inputData_), inputs->end());
+			port->inputs = inputs;
+		}
+		// Waiting for the senders still dispatching to this input, so
+		// that it can be destroyed.  The port must therefore not be
+		// closed from its own callback.
+		while (data->senders.load() != 0)
+			std::this_thread::yield();
+		data->port = 0;
+		connected_ = false;
+	}
+}
+
+unsigned int MidiInLoopback::getPortCount()
+{
+	return MidiLoopback::getPortCount();
+}
+
+std::string MidiInLoopback::getPortName(unsigned int portNumber)
+{
+	return MidiLoopback::getPortName(portNumber);
+}
+
+//*********************************************************************//
+//  API: Loopback
+//  Class Definitions: MidiOutLoopback
+//*********************************************************************//
+
+MidiOutLoopback::MidiOutLoopback(const std::string clientName) : MidiOutApi()
+{
+	initialize(clientName);
+}
+
+MidiOutLoopback :: ~MidiOutLoopback()
+{
+	// Close a connection if it exists.
+	closePort();
+}
+
+void MidiOutLoopback::initialize(const std::string& /*clientName*/)
+{
+	// The output only needs to remember the port it is connected to.
+	apiData_ = 0;
+}
+
+void MidiOutLoopback::openPort(unsigned int portNumber, const std::string /*portName*/)
+{
+	if (connected_) {
+		errorString_ = "MidiOutLoopback::openPort: a valid connection already exists!";
+		error(RtMidiError::WARNING, errorString_);
+		return;
+	}
+
+	LoopbackPort *port = getLoopbackPort(portNumber);
+	if (!port) {
+		std::ostringstream ost;
+		ost << "MidiOutLoopback::openPort: the 'portNumber' argument (" << portNumber << ") is invalid.";
+		errorString_ = ost.str();
+		error(RtMidiError::INVALID_PARAMETER, errorString_);
+		return;
+	}
+
+	apiData_ = (void *)port;
+	connected_ = true;
+}
+
+void MidiOutLoopback::openVirtualPort(const std::string portName)
+{
+	openPort(MidiLoopback::addPort(portName), portName);
+}
+
+void MidiOutLoopback::closePort(void)
+{
+	apiData_ = 0;
+	connected_ = false;
+}
+
+unsigned int MidiOutLoopback::getPortCount()
+{
+	return MidiLoopback::getPortCount();
+}
+
+std::string MidiOutLoopback::getPortName(unsigned int portNumber)
+{
+	return MidiLoopback::getPortName(portNumber);
+}
+
+void MidiOutLoopback::sendMessage(const unsigned char *message, size_t size)
+{
+	if (!connected_) return;
+
+	if (size == 0) {
+		errorString_ = "MidiOutLoopback::sendMessage: message argument is empty!";
+		error(RtMidiError::WARNING, errorString_);
+		return;
+	}
+
+	long long arrivalTime = RtMidiEvent::now();
+	LoopbackPort *port = static_cast<LoopbackPort *> (apiData_);
+	std::shared_ptr<const std::vector<MidiInApi::RtMidiInData *> > inputs;
+	{
+		std::lock_guard<std::mutex> lock(port->mutex);
+		inputs = port->inputs;
+		for (size_t i = 0; i < inputs->size(); i++)
+			static_cast<LoopbackInData *> ((*inputs)[i]->apiData)->senders.fetch_add(1);
+	}
+	for (size_t i = 0; i < inputs->size(); i++) {
+		MidiInApi::RtMidiInData *data = (*inputs)[i];
+		loopbackDeliver(data, message, size, arrivalTime);
+		static_cast<LoopbackInData *> (data->apiData)->senders.fetch_sub(1);
+	}
+}
+
+//*********************************************************************//
+//  API: Replay
+//*********************************************************************//
+
+// Capture files and Standard MIDI Files played back as input ports.
+// Each open input has a thread reading its file one message at a time,
+// so that files of any length are played in constant memory.
+
+#include <condition_variable>
+#include <thread>
+
+struct ReplayPort {
+	std::string name;
+	std::string path;
+	MidiReplay::Timing timing;
+	// Number of inputs still playing the file.
+	unsigned int playing;
+	std::mutex mutex;
+	std::condition_variable ended;
+};
+
+// Ports are never removed, so the pointers stay valid.
+static std::vector<ReplayPort *> replayPorts;
+static std::mutex replayPortsMutex;
+
+static ReplayPort *getReplayPort(unsigned int portNumber)
+{
+	std::lock_guard<std::mutex> lock(replayPortsMutex);
+	if (portNumber >= replayPorts.size()) return 0;
+	return replayPorts[portNumber];
+}
+
+// A structure to hold the state of a replay input.
+struct ReplayInData {
+	ReplayPort *port;
+	MidiCapture::Source *source;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable stopRequested;
+	bool stopping;
+};
+
+static void replayThread(MidiInApi::RtMidiInData *data)
+{
+	ReplayInData *apiData = static_cast<ReplayInData *> (data->apiData);
+	ReplayPort *port = apiData->port;
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const long long startTime = apiData->source->startTime();
+	long long lastTime = startTime;
+	bool first = true;
+
+	MidiCapture::Message message;
+	while (apiData->source->next(message)) {
+		if (port->timing == MidiReplay::RECORDED) {
+			std::unique_lock<std::mutex> lock(apiData->mutex);
+			std::chrono::steady_clock::time_point due = start + std::chrono::nanoseconds(message.time - startTime);
+			if (apiData->stopRequested.wait_until(lock, due, [apiData] { return apiData->stopping; }))
+				break;
+		}
+		else {
+			std::lock_guard<std::mutex> lock(apiData->mutex);
+			if (apiData->stopping) break;
+		}
+
+		// The time stamps are the recorded ones, whatever the timing.
+		double timeStamp = 0.0;
+		if (first) first = false;
+		else timeStamp = (double)(message.time - lastTime) * 0.000000001;
+		lastTime = message.time;
+
+		unsigned char status = message.bytes[0];
+		if (status == 0xF0) {
+			if (!(data->ignoreFlags & 0x01))
+				MidiInApi::dispatchSysEx(data, timeStamp, RtMidiEvent::now(), message.bytes, message.size);
+			continue;
+		}
+		if ((status == 0xF1 || status == 0xF8) && (data->ignoreFlags & 0x02)) continue;
+		if (status == 0xFE && (data->ignoreFlags & 0x04)) continue;
+
+		// An event holds 3 bytes at most, which is the size of any message but SysEx.
+		MidiInApi::dispatchEvent(data, RtMidiEvent::pack(message.bytes, message.size < 3 ? (unsigned int)message.size : 3, timeStamp, RtMidiEvent::now()));
+	}
+
+	std::lock_guard<std::mutex> lock(port->mutex);
+	port->playing--;
+	port->ended.notify_all();
+}
+
+unsigned int MidiReplay::addPort(const std::string &portName, const std::string &path, Timing timing)
+{
+	ReplayPort *port = new ReplayPort;
+	port->name = portName;
+	port->path = path;
+	port->timing = timing;
+	port->playing = 0;
+
+	std::lock_guard<std::mutex> lock(replayPortsMutex);
+	replayPorts.push_back(port);
+	return (unsigned int)replayPorts.size() - 1;
+}
+
+unsigned int MidiReplay::getPortCount(void)
+{
+	std::lock_guard<std::mutex> lock(replayPortsMutex);
+	return (unsigned int)replayPorts.size();
+}
+
+std::string MidiReplay::getPortName(unsigned int portNumber)
+{
+	ReplayPort *port = getReplayPort(portNumber);
+	if (!port) return std::string();
+	return port->name;
+}
+
+void MidiReplay::waitForEnd(unsigned int portNumber)
+{
+	ReplayPort *port = getReplayPort(portNumber);
+	if (!port) return;
+
+	std::unique_lock<std::mutex> lock(port->mutex);
+	port->ended.wait(lock, [port] { return port->playing == 0; });
+}
+
+//*********************************************************************//
+//  API: Replay
+//  Class Definitions: MidiInReplay
+//*********************************************************************//
+
+MidiInReplay::MidiInReplay(const std::string clientName, unsigned int queueSizeLimit) : MidiInApi(queueSizeLimit)
+{
+	initialize(clientName);
+}
+
+MidiInReplay :: ~MidiInReplay()
+{
+	// Close a connection if it exists.
+	closePort();
+
+	// Cleanup.
+	delete static_cast<ReplayInData *> (apiData_);
+}
+
+void MidiInReplay::initialize(const std::string& /*clientName*/)
+{
+	// Save our api-specific connection information.
+	ReplayInData *data = new ReplayInData;
+	data->port = 0;
+	data->source = 0;
+	data->stopping = false;
+	apiData_ = (void *)data;
+	inputData_.apiData = (void *)data;
+}
+
+void MidiInReplay::openPort(unsigned int portNumber, const std::string /*portName*/)
+{
+	if (connected_) {
+		errorString_ = "MidiInReplay::openPort: a valid connection already exists!";
+		error(RtMidiError::WARNING, errorString_);
+		return;
+	}
+
+	ReplayPort *port = getReplayPort(portNumber);
+	if (!port) {
+		std::ostringstream ost;
+		ost << "MidiInReplay::openPort: the 'portNumber' argument (" << portNumber << ") is invalid.";
+		errorString_ = ost.str();
+		error(RtMidiError::INVALID_PARAMETER, errorString_);
+		return;
+	}
+
+	ReplayInData *data = static_cast<ReplayInData *> (apiData_);
+	try {
+		data->source = MidiCapture::openSource(port->path);
+	}
+	catch (RtMidiError &exception) {
+		errorString_ = exception.getMessage();
+		error(RtMidiError::INVALID_PARAMETER, errorString_);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(port->mutex);
+		port->playing++;
+	}
+	data->port = port;
+	data->stopping = false;
+	inputData_.doInput = true;
+	inputData_.firstMessage = true;
+	data->thread = std::thread(replayThread, &inputData_);
+	connected_ = true;
+}
+
+void MidiInReplay::openVirtualPort(const std::string /*portName*/)
+{
+	errorString_ = "MidiInReplay::openVirtualPort: cannot be implemented with capture files, use MidiReplay::addPort!";
+	error(RtMidiError::WARNING, errorString_);
+}
+
+void MidiInReplay::closePort(void)
+{
+	if (connected_) {
+		ReplayInData *data = static_cast<ReplayInData *> (apiData_);
+		{
+			std::lock_guard<std::mutex> lock(data->mutex);
+			data->stopping = true;
+		}
+		data->stopRequested.notify_one();
+		data->thread.join();
+		delete data->source;
+		data->source = 0;
+		data->port = 0;
+		inputData_.doInput = false;
+		connected_ = false;
+	}
+}
+
+unsigned int MidiInReplay::getPortCount()
+{
+	return MidiReplay::getPortCount();
+}
+
+std::string MidiInReplay::getPortName(unsigned int portNumber)
+{
+	return MidiReplay::getPortName(portNumber);
+}
+
+//*********************************************************************//
+//  API: Replay
+//  Class Definitions: MidiOutReplay
+//*********************************************************************//
+
+MidiOutReplay::MidiOutReplay(const std::string clientName) : MidiOutApi()
+{
+	initialize(clientName);
+}
+
+MidiOutReplay :: ~MidiOutReplay()
+{
+	// Close a connection if it exists.
+	closePort();
+}
+
+void MidiOutReplay::initialize(const std::string& /*clientName*/)
+{
+	apiData_ = 0;
+}
+
+void MidiOutReplay::openPort(unsigned int portNumber, const std::string /*portName*/)
+{
+	if (connected_) {
+		errorString_ = "MidiOutReplay::openPort: a valid connection already exists!";
+		error(RtMidiError::WARNING, errorString_);
+		return;
+	}
+
+	if (!getReplayPort(portNumber)) {
+		std::ostringstream ost;
+		ost << "MidiOutReplay::openPort: the 'portNumber' argument (" << portNumber << ") is invalid.";
+		errorString_ = ost.str();
+		error(RtMidiError::INVALID_PARAMETER, errorString_);
+		return;
+	}
+
+	connected_ = true;
+}
+
+void MidiOutReplay::openVirtualPort(const std::string /*portName*/)
+{
+	errorString_ = "MidiOutReplay::openVirtualPort: cannot be implemented with capture files, use MidiReplay::addPort!";
+	error(RtMidiError::WARNING, errorString_);
+}
+
+void MidiOutReplay::closePort(void)
+{
+	connected_ = false;
+}
+
+unsigned int MidiOutReplay::getPortCount()
+{
+	return MidiReplay::getPortCount();
+}
+
+std::string MidiOutReplay::getPortName(unsigned int portNumber)
+{
+	return MidiReplay::getPortName(portNumber);
+}
+
+void MidiOutReplay::sendMessage(const unsigned char * /*message*/, size_t size)
+{
+	if (!connected_) return;
+
+	if (size == 0) {
+		errorString_ = "MidiOutReplay::sendMessage: message argument is empty!";
+		error(RtMidiError::WARNING, errorString_);
+		return;
+	}
+
+	// The device of a capture file cannot receive anything.
+}
+
+#if defined(__LINUX_FD__)
+
+//*********************************************************************//
+//  API: LINUX File descriptors
+//*********************************************************************//
+
+// Raw MIDI byte streams read and written with read() and write().
+// Each input has a thread waiting with epoll on its descriptor and on
+// an eventfd used to stop it.  Everything available is read at once,
+// and the bytes are parsed into messages as a MIDI 1.0 receiver would.
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <errno.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+struct FdPort {
+	std::string name;
+	// Device node opened by openPort, or empty for registered descriptors.
+	std::string path;
+	int inputFd;
+	int outputFd;
+};
+
+static std::vector<FdPort> registeredFdPorts;
+static std::mutex registeredFdPortsMutex;
+
+// Long name of each sound card, such as "Launch Control", from /proc/asound/cards.
+static std::string fdCardName(unsigned int card)
+{
+	std::ifstream cards("/proc/asound/cards");
+	std::string line;
+	while (std::getline(cards, line)) {
+		std::istringstream fields(line);
+		unsigned int number;
+		if (!(fields >> number) || number != card) continue;
+		size_t separator = line.find("]: ");
+		if (separator == std::string::npos) break;
+		separator = line.find(" - ", separator);
+		if (separator == std::string::npos) break;
+		return line.substr(separator + 3);
+	}
+	std::ostringstream name;
+	name << "Card " << card;
+	return name.str();
+}
+
+// The registered ports, then the rawmidi device nodes.  Listed again on
+// every call, so devices plugged in later are found.
+static std::vector<FdPort> listFdPorts()
+{
+	std::vector<FdPort> ports;
+	{
+		std::lock_guard<std::mutex> lock(registeredFdPortsMutex);
+		ports = registeredFdPorts;
+	}
+
+	std::vector<std::pair<unsigned int, unsigned int> > devices;
+	DIR *directory = opendir("/dev/snd");
+	if (directory) {
+		struct dirent *entry;
+		while ((entry = readdir(directory)) != NULL) {
+			unsigned int card, device;
+			char end;
+			if (sscanf(entry->d_name, "midiC%uD%u%c", &card, &device, &end) == 2)
+				devices.push_back(std::make_pair(card, device));
+		}
+		closedir(directory);
+	}
+	std::sort(devices.begin(), devices.end());
+
+	for (size_t i = 0; i < devices.size(); i++) {
+		std::ostringstream name, path;
+		name << fdCardName(devices[i].first) << " " << devices[i].first << ":" << devices[i].second;
+		path << "/dev/snd/midiC" << devices[i].first << "D" << devices[i].second;
+		FdPort port = { name.str(), path.str(), -1, -1 };
+		ports.push_back(port);
+	}
+	return ports;
+}
+
+// Opens the input (read) or output (write) side of a port.  Returns -1
+// and sets errorText on failure.
+static int openFdPort(unsigned int portNumber, bool input, std::string &errorText)
+{
+	std::vector<FdPort> ports = listFdPorts();
+	if (portNumber >= ports.size()) {
+		std::ostringstream ost;
+		ost << "the 'portNumber' argument (" << portNumber << ") is invalid.";
+		errorText = ost.str();
+		return -1;
+	}
+
+	const FdPort &port = ports[portNumber];
+	int fd;
+	if (!port.path.empty()) {
+		fd = open(port.path.c_str(), (input ? O_RDONLY | O_NONBLOCK : O_WRONLY) | O_CLOEXEC);
+	}
+	else {
+		int registered = input ? port.inputFd : port.outputFd;
+		if (registered < 0) {
+			errorText = input ? "the port has no input." : "the port has no output.";
+			return -1;
+		}
+		fd = fcntl(registered, F_DUPFD_CLOEXEC, 0);
+		if (fd >= 0 && input)
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	}
+	if (fd < 0)
+		errorText = std::string("error opening the port: ") + strerror(errno);
+	return fd;
+}
+
+// A structure to hold the state of a file descriptor input.
+struct FdInData {
+	int fd;
+	// Written to stop the input thread.
+	int wakeFd;
+	std::thread thread;
+	long long lastTime;
+
+	// Byte stream parser.  message holds the channel or system common
+	// message being received, which needs expected data bytes.
+	unsigned char runningStatus;
+	unsigned char message[3];
+	unsigned int count;
+	unsigned int expected;
+	bool inSysex;
+	std::vector<unsigned char> sysex;
+};
+
+static void fdDispatch(MidiInApi::RtMidiInData *data, const unsigned char *bytes, size_t nBytes, long long arrivalTime)
+{
+	FdInData *apiData = static_cast<FdInData *> (data->apiData);
+
+	unsigned char status = bytes[0];
+	if (status == 0xF0 && (data->ignoreFlags & 0x01)) return;
+	if ((status == 0xF1 || status == 0xF8) && (data->ignoreFlags & 0x02)) return;
+	if (status == 0xFE && (data->ignoreFlags & 0x04)) return;
+
+	// Calculate time stamp.
+	double timeStamp = 0.0;
+	if (data->firstMessage == true)
+		data->firstMessage = false;
+	else timeStamp = (double)(arrivalTime - apiData->lastTime) * 0.000000001;
+	apiData->lastTime = arrivalTime;
+
+	if (status == 0xF0)
+		MidiInApi::dispatchSysEx(data, timeStamp, arrivalTime, bytes, nBytes);
+	else
+		MidiInApi::dispatchEvent(data, RtMidiEvent::pack(bytes, (unsigned int)nBytes, timeStamp, arrivalTime));
+}
+
+// Number of data bytes following a status byte.
+static unsigned int fdDataBytes(unsigned char status)
+{
+	if (status < 0xF0) return ((status & 0xE0) == 0xC0) ? 1 : 2;
+	if (status == 0xF1 || status == 0xF3) return 1;
+	if (status == 0xF2) return 2;
+	return 0;
+}
+
+static void fdParse(MidiInApi::RtMidiInData *data, const unsigned char *bytes, size_t nBytes, long long arrivalTime)
+{
+	FdInData *apiData = static_cast<FdInData *> (data->apiData);
+
+	for (size_t i = 0; i < nBytes; i++) {
+		unsigned char byte = bytes[i];
+
+		// Real-time messages can appear anywhere, even inside other messages.
+		if (byte >= 0xF8) {
+			fdDispatch(data, &byte, 1, arrivalTime);
+			continue;
+		}
+
+		if (apiData->inSysex) {
+			if (byte < 0x80) {
+				apiData->sysex.push_back(byte);
+				continue;
+			}
+			apiData->inSysex = false;
+			if (byte == 0xF7) {
+				apiData->sysex.push_back(byte);
+				fdDispatch(data, apiData->sysex.data(), apiData->sysex.size(), arrivalTime);
+				continue;
+			}
+			// Any other status byte ends the SysEx, which is dropped.
+		}
+
+		if (byte == 0xF0) {
+			apiData->inSysex = true;
+			apiData->sysex.clear();
+			apiData->sysex.push_back(byte);
+			apiData->runningStatus = 0;
+			apiData->count = 0;
+			continue;
+		}
+
+		if (byte & 0x80) {
+			// System common messages cancel running status.
+			apiData->runningStatus = byte < 0xF0 ? byte : 0;
+			apiData->expected = fdDataBytes(byte);
+			apiData->message[0] = byte;
+			apiData->count = 1;
+			if (apiData->expected == 0) {
+				if (byte != 0xF7) fdDispatch(data, apiData->message, 1, arrivalTime);
+				apiData->count = 0;
+			}
+			continue;
+		}
+
+		// Data byte
+		if (apiData->count == 0) {
+			if (apiData->runningStatus == 0) continue;
+			apiData->message[0] = apiData->runningStatus;
+			apiData->expected = fdDataBytes(apiData->runningStatus);
+			apiData->count = 1;
+		}
+		apiData->message[apiData->count++] = byte;
+		if (apiData->count == apiData->expected + 1) {
+			fdDispatch(data, apiData->message, apiData->count, arrivalTime);
+			apiData->count = 0;
+		}
+	}
+}
+
+static void fdInputThread(MidiInApi::RtMidiInData *data)
+{
+	FdInData *apiData = static_cast<FdInData *> (data->apiData);
+
+	int epollFd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.fd = apiData->fd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, apiData->fd, &event);
+	event.data.fd = apiData->wakeFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, apiData->wakeFd, &event);
+
+	unsigned char buffer[4096];
+	struct epoll_event events[2];
+	bool stopping = false;
+	while (!stopping) {
+		int nEvents = epoll_wait(epollFd, events, 2, -1);
+		if (nEvents < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		for (int i = 0; i < nEvents; i++) {
+			if (events[i].data.fd == apiData->wakeFd) {
+				stopping = true;
+				continue;
+			}
+
+			// Draining the descriptor, all the bytes of a read arrived at the same time.
+			ssize_t nRead;
+			while ((nRead = read(apiData->fd, buffer, sizeof(buffer))) > 0)
+				fdParse(data, buffer, (size_t)nRead, RtMidiEvent::now());
+
+			// End of file, when the writer of a pipe is closed: only waiting to be stopped.
+			if (nRead == 0 || (nRead < 0 && errno != EAGAIN && errno != EINTR))
+				epoll_ctl(epollFd, EPOLL_CTL_DEL, apiData->fd, NULL);
+		}
+	}
+	close(epollFd);
+}
+
+unsigned int MidiFd::addPort(const std::string &portName, int inputFd, int outputFd)
+{
+	FdPort port = { portName, std::string(), inputFd, outputFd };
+
+	std::lock_guard<std::mutex> lock(registeredFdPortsMutex);
+	registeredFdPorts.push_back(port);
+	return (unsigned int)registeredFdPorts.size() - 1;
+}
+
+unsigned int MidiFd::getPortCount(void)
+{
+	return (unsigned int)listFdPorts().size();
+}
+
+std::string MidiFd::getPortName(unsigned int portNumber)
+{
+	std::vector<FdPort> ports = listFdPorts();
+	if (portNumber >= ports.size()) return std::string();
+	return ports[portNumber].name;
+}
+
+//*********************************************************************//
+//  API: LINUX File descriptors
+//  Class Definitions: MidiInFd
+//*********************************************************************//
+
+MidiInFd::MidiInFd(const std::string clientName, unsigned int queueSizeLimit) : MidiInApi(queueSizeLimit)
+{
+	initialize(clientName);
+}
+
+MidiInFd :: ~MidiInFd()
+{
+	// Close a connection if it exists.
+	closePort();
+
+	// Cleanup.
+	delete static_cast<FdInData *> (apiData_);
+}
+
+void MidiInFd::initialize(const std::string& /*clientName*/)
+{
+	// Save our api-specific connection information.
+	FdInData *data = new FdInData;
+	data->fd = -1;
+	data->wakeFd = -1;
+	data->lastTime = 0;
+	data->runningStatus = 0;
+	data->count = 0;
+	data->expected = 0;
+	data->inSysex = false;
+	// Longer SysEx messages grow the buffer once.
+	data->sysex.reserve(1024);
+	apiData_ = (void *)data;
+	inputData_.apiData = (void *)data;
+}
+
+void MidiInFd::openPort(unsigned int portNumber, const std::string /*portName*/)
+{
+	if (connected_) {
+		errorString_ = "MidiInFd::openPort: a valid connection already exists!";
+		error(RtMidiError::WARNING, errorString_);
+		return;
+	}
+
+	std::string errorText;
+	int fd = openFdPort(portNumber, true, errorText);
+	if (fd < 0) {
+		errorString_ = "MidiInFd::openPort: " + errorText;
+		error(RtMidiError::INVALID_PARAMETER, errorString_);
+		return;
+	}
+
+	FdInData *data = static_cast<FdInData *> (apiData_);
+	data->wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (data->wakeFd < 0) {
+		close(fd);
+		errorString_ = "MidiInFd::openPort: error creating the eventfd.";
+		error(RtMidiError::SYSTEM_ERROR, errorString_);
+		return;
+	}
+	data->fd = fd;
+	data->runningStatus = 0;
+	data->count = 0;
+	data->inSysex = false;
+	inputData_.doInput = true;
+	data->thread = std::thread(fdInputThread, &inputData_);
+	connected_ = true;
+}
+
+void MidiInFd::openVirtualPort(const std::string /*portName*/)
+{
+	// Register the descriptors with MidiFd::addPort instead.
+	errorString_ = "MidiInFd::openVirtualPort: cannot be implemented with file descriptors, use MidiFd::addPort!";
+	error(RtMidiError::WARNING, errorString_);
+}
+
+void MidiInFd::closePort(void)
+{
+	if (connected_) {
+		FdInData *data = static_cast<FdInData *> (apiData_);
+		uint64_t stop = 1;
+		if (write(data->wakeFd, &stop, sizeof(stop)) < 0) {}
+		data->thread.join();
+		close(data->wakeFd);
+		close(data->fd);
+		data->wakeFd = -1;
+		data->fd = -1;
+		inputData_.doInput = false;
+		connected_ = false;
+	}
+}
+
+unsigned int MidiInFd::getPortCount()
+{
+	return MidiFd::getPortCount();
+}
+
+std::string MidiInFd::getPortName(unsigned int portNumber)
+{
+	return MidiFd::getPortName(portNumber);
+}
+
+//*********************************************************************//
+//  API: LINUX File descriptors
+//  Class Definitions: MidiOutFd
+//*********************************************************************//
+
+MidiOutFd::MidiOutFd(const std::string clientName) : MidiOutApi()
+{
+	initialize(clientName);
+}
+
+MidiOutFd :: ~MidiOutFd()
+{
+	// Close a connection if it exists.
+	closePort();
+}
+
+void MidiOutFd::initialize(const std::string& /*clientName*/)
+{
+	// The descriptor is stored in apiData_ when the port is opened.
+	apiData_ = 0;
+}
+
+void MidiOutFd::openPort(unsigned int portNumber, const std::string /*portName*/)
+{
+	if (connected_) {
+		errorString_ = "MidiOutFd::openPort: a valid connection already exists!";
+		error(RtMidiError::WARNING, errorString_);
+		return;
+	}
+
+	std::string errorText;
+	int fd = openFdPort(portNumber, false, errorText);
+	if (fd < 0) {
+		errorString_ = "MidiOutFd::openPort: " + errorText;
+		error(RtMidiError::INVALID_PARAMETER, errorString_);
+		return;
+	}
+
+	apiData_ = (void *)(intptr_t)fd;
+	connected_ = true;
+}
+
+void MidiOutFd::openVirtualPort(const std::string /*portName*/)
+{
+	errorString_ = "MidiOutFd::openVirtualPort: cannot be implemented with file descriptors, use MidiFd::addPort!";
+	error(RtMidiError::WARNING, errorString_);
+}
+
+void MidiOutFd::closePort(void)
+{
+	if (connected_) {
+		close((int)(intptr_t)apiData_);
+		apiData_ = 0;
+		connected_ = false;
+	}
+}
+
+unsigned int MidiOutFd::getPortCount()
+{
+	return MidiFd::getPortCount();
+}
+
+std::string MidiOutFd::getPortName(unsigned int portNumber)
+{
+	return MidiFd::getPortName(portNumber);
+}
+
+void MidiOutFd::sendMessage(const unsigned char *message, size_t size)
+{
+	if (!connected_) return;
+
+	if (size == 0) {
+		errorString_ = "MidiOutFd::sendMessage: message argument is empty!";
+		error(RtMidiError::WARNING, errorString_);
+		return;
+	}
+
+	int fd = (int)(intptr_t)apiData_;
+	size_t written = 0;
+	while (written < size) {
+		ssize_t result = write(fd, message + written, size - written);
+		if (result > 0) {
+			written += (size_t)result;
+			continue;
+		}
+		if (result < 0 && errno == EINTR) continue;
+		if (result < 0 && errno == EAGAIN) {
+			// Non-blocking descriptor full: waiting until it can be written.
+			struct pollfd writable = { fd, POLLOUT, 0 };
+			poll(&writable, 1, -1);
+			continue;
+		}
+		errorString_ = "MidiOutFd::sendMessage: error writing MIDI message.";
+		error(RtMidiError::DRIVER_ERROR, errorString_);
+		return;
+	}
+}
+
+#endif  // __LINUX_FD__
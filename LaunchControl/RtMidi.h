@@ -45,10 +45,13 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #define RTMIDI_VERSION "2.1.1"
 
+#include <atomic>
+#include <chrono>
 #include <exception>
 #include <iostream>
 #include <string>
 #include <vector>
+#include "SpscRing.h"
 
 /************************************************************************/
 /*! \class RtMidiError
@@ -124,7 +127,10 @@ public:
 		LINUX_ALSA,     /*!< The Advanced Linux Sound Architecture API. */
 		UNIX_JACK,      /*!< The JACK Low-Latency MIDI Server API. */
 		WINDOWS_MM,     /*!< The Microsoft Multimedia MIDI API. */
-		RTMIDI_DUMMY    /*!< A compilable but non-functional API. */
+		RTMIDI_DUMMY,   /*!< A compilable but non-functional API. */
+		RTMIDI_LOOPBACK, /*!< In-process ports connecting RtMidiOut to RtMidiIn, see MidiLoopback. */
+		LINUX_FD,       /*!< Raw MIDI byte streams on file descriptors (Linux), see MidiFd. */
+		RTMIDI_REPLAY   /*!< Input played back from capture files, see MidiReplay. */
 	};
 
 	//! A static function to determine the current RtMidi version.
@@ -202,8 +208,86 @@ by Gary P. Scavone, 2003-2014.
 // make a "logical" API selection.
 //
 // **************************************************************** //
+//! A MIDI channel or system message packed into a single 32-bit word, with its time stamp.
+/*!
+The packed word is laid out like a Universal MIDI Packet: the number
+of bytes in the message in the most significant byte, followed by the
+status byte and the two data bytes (0xNNSSD1D2). Unused data bytes are
+zero. System exclusive messages do not fit in an event and are
+delivered separately, see RtMidiIn::setSysExCallback().
+*/
+struct RtMidiEvent
+{
+	unsigned int packet;
+	//! Delta time in seconds since the previous message.
+	double timeStamp;
+	//! Time at which the driver delivered the message, in nanoseconds of std::chrono::steady_clock.
+	long long arrivalTime;
+
+	//! The current time in the unit of \e arrivalTime.
+	static long long now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	unsigned char size() const { return (unsigned char)(packet >> 24); }
+	unsigned char status() const { return (unsigned char)(packet >> 16); }
+	unsigned char data1() const { return (unsigned char)(packet >> 8); }
+	unsigned char data2() const { return (unsigned char)packet; }
+
+	//! Returns the byte at index 0 (status), 1 or 2 (data bytes).
+	unsigned char operator[](size_t i) const { return (unsigned char)(packet >> (16 - 8 * i)); }
+
+	//! Packs up to 3 bytes of a channel or system message.
+	static RtMidiEvent pack(const unsigned char *bytes, unsigned int nBytes, double timeStamp = 0.0, long long arrivalTime = 0)
+	{
+		RtMidiEvent event;
+		event.packet = nBytes << 24;
+		for (unsigned int i = 0; i < nBytes && i < 3; i++)
+			event.packet |= (unsigned int)bytes[i] << (16 - 8 * i);
+		event.timeStamp = timeStamp;
+		event.arrivalTime = arrivalTime;
+		return event;
+	}
+};
+
 //! User callback function type definition.
-typedef void(*RtMidiCallback)(double timeStamp, std::vector<unsigned char> *message, void *userData);
+typedef void(*RtMidiCallback)(const RtMidiEvent &event, void *userData);
+
+//! User callback function type for system exclusive messages.
+/*!
+The bytes, including the leading 0xF0 and trailing 0xF7, are only
+valid for the duration of the call.
+*/
+typedef void(*RtMidiSysExCallback)(double timeStamp, long long arrivalTime, const unsigned char *bytes, size_t nBytes, void *userData);
+
+namespace MidiCapture { class Writer; }
+
+//! Counters of the messages received by an RtMidiIn, see RtMidiIn::stats().
+struct RtMidiInStats
+{
+	// Channel messages by type, indexed by (status >> 4) - 8: note off,
+	// note on, key pressure, control change, program change, channel
+	// pressure and pitch bend.
+	unsigned long long channelMessages[7];
+	// System common and real-time messages, SysEx excepted.
+	unsigned long long systemMessages;
+	unsigned long long sysexMessages;
+	unsigned long long sysexBytes;
+	// Messages lost because the queue was full, when no callback is set.
+	unsigned long long droppedMessages;
+	// Most messages ever waiting in the queue at once.
+	unsigned int queueHighWater;
+};
+
+//! Counters of the messages sent by an RtMidiOut, see RtMidiOut::stats().
+struct RtMidiOutStats
+{
+	unsigned long long messages;
+	unsigned long long bytes;
+	unsigned long long sysexMessages;
+	unsigned long long sysexBytes;
+};
 
 class RtMidiIn : public RtMidi
 {
@@ -215,8 +299,8 @@ public:
 	An exception will be thrown if a MIDI system initialization
 	error occurs.  The queue size defines the maximum number of
 	messages that can be held in the MIDI queue (when not using a
-	callback function).  If the queue size limit is reached,
-	incoming messages will be ignored.
+	callback function), rounded up to a power of two.  If the queue
+	size limit is reached, incoming messages will be ignored.
 
 	If no API argument is specified and multiple API support has been
 	compiled, the default order of use is ALSA, JACK (Linux) and CORE,
@@ -271,6 +355,24 @@ public:
 	*/
 	void setCallback(RtMidiCallback callback, void *userData = 0);
 
+	//! Set a callback function to be invoked for incoming system exclusive messages.
+	/*!
+	System exclusive messages are never queued or passed to the
+	callback set with \e setCallback.  They are only delivered to this
+	function, and only if they are not ignored (see \e ignoreTypes).
+	*/
+	void setSysExCallback(RtMidiSysExCallback callback, void *userData = 0);
+
+	//! Record the incoming messages to a capture file (see MidiCapture.h).
+	/*!
+	Every message that is not ignored is copied to \e capture before it
+	is passed to the callbacks or queued.  The writer must stay alive
+	while it is set.  A null pointer stops recording.  When this function
+	returns, the input thread is done with the previous writer, which can
+	then be closed.
+	*/
+	void setCapture(MidiCapture::Writer *capture);
+
 	//! Cancel use of the current callback function (if one exists).
 	/*!
 	Subsequent incoming MIDI messages will be written to the queue
@@ -317,6 +419,29 @@ public:
 	*/
 	double getMessage(std::vector<unsigned char> *message);
 
+	//! Copy the next available MIDI event in the input queue to \e event.
+	/*!
+	Returns false, without modifying \e event, if the queue is empty.
+	Unlike \e getMessage, no memory is allocated.
+	*/
+	bool getEvent(RtMidiEvent &event);
+
+	//! Move up to \e maxEvents queued MIDI events, oldest first, to the \e events array.
+	/*!
+	Returns the number of events copied, which is zero if the queue is
+	empty.  This is the cheapest way to drain the queue once per frame:
+	the events are copied in one or two contiguous blocks.
+	*/
+	unsigned int getMessages(RtMidiEvent *events, unsigned int maxEvents);
+
+	//! Returns the counters of the messages received since the port was created.
+	/*!
+	The counters are atomic and only written by the thread dispatching
+	the messages, so they can be polled from any thread at any rate
+	without slowing the input down.
+	*/
+	RtMidiInStats stats() const;
+
 	//! Set an error callback function to be invoked when an error has occured.
 	/*!
 	The callback function will be called whenever an error has occured. It is best
@@ -408,6 +533,20 @@ public:
 	*/
 	void sendMessage(std::vector<unsigned char> *message);
 
+	//! Immediately send a single message out an open MIDI output port.
+	/*!
+	The bytes are read from the caller's buffer, so sending a message
+	built on the stack does not allocate.  An exception is thrown if
+	an error occurs during output or an output connection was not
+	previously established.
+	\param message A pointer to the MIDI message as raw bytes
+	\param size    Length of the MIDI message in bytes
+	*/
+	void sendMessage(const unsigned char *message, size_t size);
+
+	//! Returns the counters of the messages sent, which can be polled from any thread.
+	RtMidiOutStats stats() const;
+
 	//! Set an error callback function to be invoked when an error has occured.
 	/*!
 	The callback function will be called whenever an error has occured. It is best
@@ -471,38 +610,23 @@ public:
 	MidiInApi(unsigned int queueSizeLimit);
 	virtual ~MidiInApi(void);
 	void setCallback(RtMidiCallback callback, void *userData);
+	void setSysExCallback(RtMidiSysExCallback callback, void *userData);
+	void setCapture(MidiCapture::Writer *capture);
 	void cancelCallback(void);
 	virtual void ignoreTypes(bool midiSysex, bool midiTime, bool midiSense);
 	double getMessage(std::vector<unsigned char> *message);
+	bool getEvent(RtMidiEvent &event);
+	unsigned int getMessages(RtMidiEvent *events, unsigned int maxEvents);
+	RtMidiInStats stats() const;
 
-	// A MIDI structure used internally by the class to store incoming
-	// messages.  Each message represents one and only one MIDI message.
-	struct MidiMessage {
-		std::vector<unsigned char> bytes;
-		double timeStamp;
-
-		// Default constructor.
-		MidiMessage()
-			:bytes(0), timeStamp(0.0) {}
-	};
-
-	struct MidiQueue {
-		unsigned int front;
-		unsigned int back;
-		unsigned int size;
-		unsigned int ringSize;
-		MidiMessage *ring;
-
-		// Default constructor.
-		MidiQueue()
-			:front(0), back(0), size(0), ringSize(0) {}
-	};
+	// The queue is written by the driver thread and read by getEvent()
+	// and getMessage(), without locking.
+	typedef SpscRing<RtMidiEvent> MidiQueue;
 
 	// The RtMidiInData structure is used to pass private class data to
 	// the MIDI input handling function or thread.
 	struct RtMidiInData {
 		MidiQueue queue;
-		MidiMessage message;
 		unsigned char ignoreFlags;
 		bool doInput;
 		bool firstMessage;
@@ -510,15 +634,44 @@ public:
 		bool usingCallback;
 		RtMidiCallback userCallback;
 		void *userData;
+		RtMidiSysExCallback sysexCallback;
+		void *sysexUserData;
 		bool continueSysex;
+		// Set while the input thread is running. captureUsers counts the
+		// dispatches using the writer, which setCapture waits for.
+		std::atomic<MidiCapture::Writer *> capture;
+		std::atomic<unsigned int> captureUsers;
+
+		// Counters of the messages dispatched, see RtMidiInStats. Only
+		// written by the thread dispatching the messages.
+		struct Counters {
+			std::atomic<unsigned long long> channelMessages[7];
+			std::atomic<unsigned long long> systemMessages;
+			std::atomic<unsigned long long> sysexMessages;
+			std::atomic<unsigned long long> sysexBytes;
+			std::atomic<unsigned long long> droppedMessages;
+			std::atomic<unsigned int> queueHighWater;
+
+			Counters() : systemMessages(0), sysexMessages(0), sysexBytes(0), droppedMessages(0), queueHighWater(0)
+			{
+				for (int i = 0; i < 7; i++)
+					channelMessages[i].store(0);
+			}
+		} counters;
 
 		// Default constructor.
 		RtMidiInData()
 			: ignoreFlags(7), doInput(false), firstMessage(true),
 			apiData(0), usingCallback(false), userCallback(0), userData(0),
-			continueSysex(false) {}
+			sysexCallback(0), sysexUserData(0), continueSysex(false), capture(nullptr), captureUsers(0) {}
 	};
 
+	// Called by the API-specific input handlers for each incoming
+	// message.  The event is passed to the user callback if one is
+	// set, otherwise it is pushed to the queue.
+	static void dispatchEvent(RtMidiInData *data, const RtMidiEvent &event);
+	static void dispatchSysEx(RtMidiInData *data, double timeStamp, long long arrivalTime, const unsigned char *bytes, size_t nBytes);
+
 protected:
 	RtMidiInData inputData_;
 };
@@ -529,7 +682,18 @@ public:
 
 	MidiOutApi(void);
 	virtual ~MidiOutApi(void);
-	virtual void sendMessage(std::vector<unsigned char> *message) = 0;
+	virtual void sendMessage(const unsigned char *message, size_t size) = 0;
+
+	// Called by RtMidiOut::sendMessage once the message is sent.
+	void countMessage(const unsigned char *message, size_t size);
+	RtMidiOutStats stats() const;
+
+protected:
+	// Several threads may send to the same output.
+	std::atomic<unsigned long long> sentMessages_;
+	std::atomic<unsigned long long> sentBytes_;
+	std::atomic<unsigned long long> sentSysexMessages_;
+	std::atomic<unsigned long long> sentSysexBytes_;
 };
 
 // **************************************************************** //
@@ -547,11 +711,19 @@ inline void RtMidiIn::setCallback(RtMidiCallback callback, void *userData)
 {
 	((MidiInApi *)rtapi_)->setCallback(callback, userData);
 }
+inline void RtMidiIn::setSysExCallback(RtMidiSysExCallback callback, void *userData)
+{
+	((MidiInApi *)rtapi_)->setSysExCallback(callback, userData);
+}
+inline void RtMidiIn::setCapture(MidiCapture::Writer *capture) { ((MidiInApi *)rtapi_)->setCapture(capture); }
 inline void RtMidiIn::cancelCallback(void) { ((MidiInApi *)rtapi_)->cancelCallback(); }
 inline unsigned int RtMidiIn::getPortCount(void) { return rtapi_->getPortCount(); }
 inline std::string RtMidiIn::getPortName(unsigned int portNumber) { return rtapi_->getPortName(portNumber); }
 inline void RtMidiIn::ignoreTypes(bool midiSysex, bool midiTime, bool midiSense) { ((MidiInApi *)rtapi_)->ignoreTypes(midiSysex, midiTime, midiSense); }
 inline double RtMidiIn::getMessage(std::vector<unsigned char> *message) { return ((MidiInApi *)rtapi_)->getMessage(message); }
+inline bool RtMidiIn::getEvent(RtMidiEvent &event) { return ((MidiInApi *)rtapi_)->getEvent(event); }
+inline unsigned int RtMidiIn::getMessages(RtMidiEvent *events, unsigned int maxEvents) { return ((MidiInApi *)rtapi_)->getMessages(events, maxEvents); }
+inline RtMidiInStats RtMidiIn::stats() const { return ((const MidiInApi *)rtapi_)->stats(); }
 inline void RtMidiIn::setErrorCallback(RtMidiErrorCallback errorCallback, void *userData) { rtapi_->setErrorCallback(errorCallback, userData); }
 
 inline RtMidi::Api RtMidiOut::getCurrentApi(void) throw() { return rtapi_->getCurrentApi(); }
@@ -561,7 +733,13 @@ inline void RtMidiOut::closePort(void) { rtapi_->closePort(); }
 inline bool RtMidiOut::isPortOpen() const { return rtapi_->isPortOpen(); }
 inline unsigned int RtMidiOut::getPortCount(void) { return rtapi_->getPortCount(); }
 inline std::string RtMidiOut::getPortName(unsigned int portNumber) { return rtapi_->getPortName(portNumber); }
-inline void RtMidiOut::sendMessage(std::vector<unsigned char> *message) { ((MidiOutApi *)rtapi_)->sendMessage(message); }
+inline void RtMidiOut::sendMessage(std::vector<unsigned char> *message) { sendMessage(message->data(), message->size()); }
+inline void RtMidiOut::sendMessage(const unsigned char *message, size_t size)
+{
+	((MidiOutApi *)rtapi_)->sendMessage(message, size);
+	((MidiOutApi *)rtapi_)->countMessage(message, size);
+}
+inline RtMidiOutStats RtMidiOut::stats() const { return ((const MidiOutApi *)rtapi_)->stats(); }
 inline void RtMidiOut::setErrorCallback(RtMidiErrorCallback errorCallback, void *userData) { rtapi_->setErrorCallback(errorCallback, userData); }
 
 // **************************************************************** //
@@ -574,6 +752,11 @@ inline void RtMidiOut::setErrorCallback(RtMidiErrorCallback errorCallback, void
 #define __RTMIDI_DUMMY__
 #endif
 
+// The file descriptor API only needs the C library, so it is always compiled on Linux.
+#if defined(__linux__) && !defined(__LINUX_FD__)
+#define __LINUX_FD__
+#endif
+
 #if defined(__MACOSX_CORE__)
 
 class MidiInCore : public MidiInApi
@@ -603,7 +786,7 @@ public:
 	void closePort(void);
 	unsigned int getPortCount(void);
 	std::string getPortName(unsigned int portNumber);
-	void sendMessage(std::vector<unsigned char> *message);
+	void sendMessage(const unsigned char *message, size_t size);
 
 protected:
 	void initialize(const std::string& clientName);
@@ -643,7 +826,7 @@ public:
 	void closePort(void);
 	unsigned int getPortCount(void);
 	std::string getPortName(unsigned int portNumber);
-	void sendMessage(std::vector<unsigned char> *message);
+	void sendMessage(const unsigned char *message, size_t size);
 
 protected:
 	std::string clientName;
@@ -683,7 +866,7 @@ public:
 	void closePort(void);
 	unsigned int getPortCount(void);
 	std::string getPortName(unsigned int portNumber);
-	void sendMessage(std::vector<unsigned char> *message);
+	void sendMessage(const unsigned char *message, size_t size);
 
 protected:
 	void initialize(const std::string& clientName);
@@ -720,7 +903,183 @@ public:
 	void closePort(void);
 	unsigned int getPortCount(void);
 	std::string getPortName(unsigned int portNumber);
-	void sendMessage(std::vector<unsigned char> *message);
+	void sendMessage(const unsigned char *message, size_t size);
+
+protected:
+	void initialize(const std::string& clientName);
+};
+
+#endif
+
+//! In-process MIDI ports, for testing and benchmarking without any hardware.
+/*!
+Ports created with \e addPort are listed by the RTMIDI_LOOPBACK API of
+both RtMidiIn and RtMidiOut, and can be opened like any device port.
+A message sent to a port is delivered synchronously, on the sending
+thread, to every input opened on that port.  When another thread is
+already delivering to an input, that thread delivers the message
+instead, so that an input is only called by one thread at a time.  An
+input must not be closed from its own callback.  Opening a virtual
+port also creates a loopback port.  The loopback API is always compiled.
+*/
+class MidiLoopback
+{
+public:
+	//! Create a port and return its port number.  Ports are never removed.
+	static unsigned int addPort(const std::string &portName);
+	static unsigned int getPortCount(void);
+	static std::string getPortName(unsigned int portNumber);
+};
+
+class MidiInLoopback : public MidiInApi
+{
+public:
+	MidiInLoopback(const std::string clientName, unsigned int queueSizeLimit);
+	~MidiInLoopback(void);
+	RtMidi::Api getCurrentApi(void) { return RtMidi::RTMIDI_LOOPBACK; };
+	void openPort(unsigned int portNumber, const std::string portName);
+	void openVirtualPort(const std::string portName);
+	void closePort(void);
+	unsigned int getPortCount(void);
+	std::string getPortName(unsigned int portNumber);
+
+protected:
+	void initialize(const std::string& clientName);
+};
+
+class MidiOutLoopback : public MidiOutApi
+{
+public:
+	MidiOutLoopback(const std::string clientName);
+	~MidiOutLoopback(void);
+	RtMidi::Api getCurrentApi(void) { return RtMidi::RTMIDI_LOOPBACK; };
+	void openPort(unsigned int portNumber, const std::string portName);
+	void openVirtualPort(const std::string portName);
+	void closePort(void);
+	unsigned int getPortCount(void);
+	std::string getPortName(unsigned int portNumber);
+	void sendMessage(const unsigned char *message, size_t size);
+
+protected:
+	void initialize(const std::string& clientName);
+};
+
+//! Input ports playing back capture files (see MidiCapture.h) or Standard MIDI Files (see MidiFile.h).
+/*!
+Ports created with \e addPort are listed by the RTMIDI_REPLAY API of
+both RtMidiIn and RtMidiOut.  Opening an input starts a thread which
+reads the file one message at a time and dispatches each message as
+a driver would, either at the recorded times or as fast as possible.
+The time stamps are the recorded delta times, and the arrival times
+are the times of dispatch.  Messages sent to an output are discarded.
+*/
+class MidiReplay
+{
+public:
+	enum Timing {
+		RECORDED,   /*!< Each message is dispatched at its recorded time after the port is opened. */
+		MAX_SPEED   /*!< The messages are dispatched one after the other, without waiting. */
+	};
+
+	//! Create a port playing back \e path and return its port number.  Ports are never removed.
+	/*!
+	The file is opened, and its format checked, when an input is opened on the port.
+	*/
+	static unsigned int addPort(const std::string &portName, const std::string &path, Timing timing = RECORDED);
+	static unsigned int getPortCount(void);
+	static std::string getPortName(unsigned int portNumber);
+
+	//! Wait until every input opened on the port has played the whole file.
+	static void waitForEnd(unsigned int portNumber);
+};
+
+class MidiInReplay : public MidiInApi
+{
+public:
+	MidiInReplay(const std::string clientName, unsigned int queueSizeLimit);
+	~MidiInReplay(void);
+	RtMidi::Api getCurrentApi(void) { return RtMidi::RTMIDI_REPLAY; };
+	void openPort(unsigned int portNumber, const std::string portName);
+	void openVirtualPort(const std::string portName);
+	void closePort(void);
+	unsigned int getPortCount(void);
+	std::string getPortName(unsigned int portNumber);
+
+protected:
+	void initialize(const std::string& clientName);
+};
+
+class MidiOutReplay : public MidiOutApi
+{
+public:
+	MidiOutReplay(const std::string clientName);
+	~MidiOutReplay(void);
+	RtMidi::Api getCurrentApi(void) { return RtMidi::RTMIDI_REPLAY; };
+	void openPort(unsigned int portNumber, const std::string portName);
+	void openVirtualPort(const std::string portName);
+	void closePort(void);
+	unsigned int getPortCount(void);
+	std::string getPortName(unsigned int portNumber);
+	void sendMessage(const unsigned char *message, size_t size);
+
+protected:
+	void initialize(const std::string& clientName);
+};
+
+#if defined(__LINUX_FD__)
+
+//! Raw MIDI byte streams on file descriptors, for Linux.
+/*!
+The ports of the LINUX_FD API are the descriptors registered with
+\e addPort, such as the ends of pipes, FIFOs or socketpairs, followed
+by the rawmidi device nodes (/dev/snd/midiC*D*) present when the ports
+are listed.  Input is read in batches by a thread waiting with epoll,
+and parsed with running status and SysEx support.  No sequencer
+daemon is involved.
+*/
+class MidiFd
+{
+public:
+	//! Register descriptors as a port and return its port number.
+	/*!
+	Either descriptor can be -1 for a port without input or output.
+	They are duplicated when the port is opened, and the caller keeps
+	ownership of them.  Opening the input makes it non-blocking.
+	Registered ports are never removed.
+	*/
+	static unsigned int addPort(const std::string &portName, int inputFd, int outputFd);
+	static unsigned int getPortCount(void);
+	static std::string getPortName(unsigned int portNumber);
+};
+
+class MidiInFd : public MidiInApi
+{
+public:
+	MidiInFd(const std::string clientName, unsigned int queueSizeLimit);
+	~MidiInFd(void);
+	RtMidi::Api getCurrentApi(void) { return RtMidi::LINUX_FD; };
+	void openPort(unsigned int portNumber, const std::string portName);
+	void openVirtualPort(const std::string portName);
+	void closePort(void);
+	unsigned int getPortCount(void);
+	std::string getPortName(unsigned int portNumber);
+
+protected:
+	void initialize(const std::string& clientName);
+};
+
+class MidiOutFd : public MidiOutApi
+{
+public:
+	MidiOutFd(const std::string clientName);
+	~MidiOutFd(void);
+	RtMidi::Api getCurrentApi(void) { return RtMidi::LINUX_FD; };
+	void openPort(unsigned int portNumber, const std::string portName);
+	void openVirtualPort(const std::string portName);
+	void closePort(void);
+	unsigned int getPortCount(void);
+	std::string getPortName(unsigned int portNumber);
+	void sendMessage(const unsigned char *message, size_t size);
 
 protected:
 	void initialize(const std::string& clientName);
@@ -755,7 +1114,7 @@ public:
 	void closePort(void) {}
 	unsigned int getPortCount(void) { return 0; }
 	std::string getPortName(unsigned int /*portNumber*/) { return ""; }
-	void sendMessage(std::vector<unsigned char> * /*message*/) {}
+	void sendMessage(const unsigned char * /*message*/, size_t /*size*/) {}
 
 protected:
 	void initialize(const std::string& /*clientName*/) {}
@@ -0,0 +1,155 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+//Ring buffer shared by exactly one producer thread and one consumer thread.
+//Neither side ever locks or waits: push() fails when the ring is full and pop()
+//fails when it is empty. The capacity is rounded up to a power of two, so that
+//the free-running indices are mapped to slots with a mask.
+//
+//Items can also be written and read in place, without copying them in and out:
+//	T* slot = ring.writeSlot(); if (slot) { fill(*slot); ring.commitWrite(); }
+//	const T* item = ring.readSlot(); if (item) { use(*item); ring.commitRead(); }
+template <typename T>
+class SpscRing
+{
+public:
+	SpscRing() : mask(0), head(0), cachedTail(0), tail(0), cachedHead(0)
+	{
+		slots.resize(1);
+	}
+
+	explicit SpscRing(unsigned int minCapacity) : SpscRing()
+	{
+		resize(minCapacity);
+	}
+
+	//Discards all the items. Must not be called while the ring is in use by the other thread.
+	void resize(unsigned int minCapacity)
+	{
+		unsigned int capacity = 1;
+		while (capacity < minCapacity)
+			capacity <<= 1;
+		slots.assign(capacity, T());
+		mask = capacity - 1;
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+		cachedHead = cachedTail = 0;
+	}
+
+	//Producer side. Returns the slot for the next item, or nullptr if the ring is full.
+	//The item is only visible to the consumer after commitWrite().
+	T* writeSlot()
+	{
+		unsigned int back = tail.load(std::memory_order_relaxed);
+		if (back - cachedHead > mask)
+		{
+			//Only reading the consumer index when the ring looks full keeps
+			//its cache line from bouncing between the two threads.
+			cachedHead = head.load(std::memory_order_acquire);
+			if (back - cachedHead > mask)
+				return nullptr;
+		}
+		return &slots[back & mask];
+	}
+
+	void commitWrite()
+	{
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	//Producer side. Returns false, without copying the item, if the ring is full.
+	bool push(const T& item)
+	{
+		T* slot = writeSlot();
+		if (slot == nullptr)
+			return false;
+		*slot = item;
+		commitWrite();
+		return true;
+	}
+
+	//Consumer side. Returns the oldest item, or nullptr if the ring is empty.
+	//The slot stays valid until commitRead().
+	const T* readSlot()
+	{
+		unsigned int front = head.load(std::memory_order_relaxed);
+		if (front == cachedTail)
+		{
+			cachedTail = tail.load(std::memory_order_acquire);
+			if (front == cachedTail)
+				return nullptr;
+		}
+		return &slots[front & mask];
+	}
+
+	void commitRead()
+	{
+		head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	//Consumer side. Returns false if the ring is empty.
+	bool pop(T& item)
+	{
+		const T* slot = readSlot();
+		if (slot == nullptr)
+			return false;
+		item = *slot;
+		commitRead();
+		return true;
+	}
+
+	//Consumer side. Moves up to maxItems of the oldest items to the items array and
+	//returns how many were moved. The indices are read and written once per call,
+	//and the items are copied in at most two contiguous runs.
+	unsigned int popBatch(T* items, unsigned int maxItems)
+	{
+		unsigned int front = head.load(std::memory_order_relaxed);
+		cachedTail = tail.load(std::memory_order_acquire);
+		unsigned int count = cachedTail - front;
+		if (count > maxItems)
+			count = maxItems;
+		if (count == 0)
+			return 0;
+
+		unsigned int first = front & mask;
+		unsigned int firstRun = (std::min)(count, mask + 1 - first);
+		std::copy(&slots[first], &slots[first] + firstRun, items);
+		std::copy(&slots[0], &slots[0] + (count - firstRun), items + firstRun);
+
+		head.store(front + count, std::memory_order_release);
+		return count;
+	}
+
+	//Number of queued items. Only exact when called from the producer or the consumer thread.
+	unsigned int size() const
+	{
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+	unsigned int capacity() const
+	{
+		return mask + 1;
+	}
+
+private:
+	//Keeps the indices written by each thread on their own cache line,
+	//so that the producer and the consumer do not invalidate each other.
+	static const unsigned int CACHE_LINE_SIZE = 64;
+
+	std::vector<T> slots;
+	unsigned int mask;
+
+	char padding0[CACHE_LINE_SIZE];
+	//Consumer: index of the next item to pop, and the last tail it read.
+	std::atomic<unsigned int> head;
+	unsigned int cachedTail;
+
+	char padding1[CACHE_LINE_SIZE];
+	//Producer: index of the next slot to push into, and the last head it read.
+	std::atomic<unsigned int> tail;
+	unsigned int cachedHead;
+
+	char padding2[CACHE_LINE_SIZE];
+};
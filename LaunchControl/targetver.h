@@ -5,5 +5,7 @@
 // If you wish to build your application for a previous Windows platform, include WinSDKVer.h and
 // set the _WIN32_WINNT macro to the platform you wish to support before including SDKDDKVer.h.
 
+#if defined(_WIN32)
 #include <SDKDDKVer.h>
+#endif
 
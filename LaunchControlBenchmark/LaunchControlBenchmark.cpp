@@ -0,0 +1,1237 @@
+// LaunchControlBenchmark.cpp : Measures the hot paths of the LaunchControl library.
+//
+// Every benchmark runs against in-process ports (RTMIDI_LOOPBACK and RTMIDI_REPLAY), so no
+// device is needed. The results are written as JSON to the file given as first argument,
+// LaunchControlBenchmark.json by default, to be compared between two builds. Each timed
+// benchmark also reports the heap allocations made per operation.
+//
+
+#include "stdafx.h"
+#include "../LaunchControl/LaunchControl.h"
+#include "../LaunchControl/LaunchControlSysEx.h"
+#include "../LaunchControl/LedAnimator.h"
+#include "../LaunchControl/MidiCapture.h"
+#include "../LaunchControl/MidiFile.h"
+#include "../LaunchControl/SpscRing.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__LINUX_FD__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+typedef std::chrono::steady_clock Clock;
+
+//Counting every allocation of the process, to check that the hot paths never allocate.
+static std::atomic<unsigned long long> allocationCount(0);
+
+void* operator new(size_t size)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	void* memory = malloc(size != 0 ? size : 1);
+	if (memory == nullptr)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+//Results are added to the sink, so that the compiler cannot remove the calls being measured.
+static volatile unsigned int sink;
+
+//Each timed benchmark runs for at least this long.
+static const std::chrono::milliseconds MIN_TIME(300);
+
+class Report
+{
+public:
+	typedef std::vector<std::pair<std::string, double> > Fields;
+
+	void add(const std::string& name, const Fields& fields)
+	{
+		std::ostringstream entry;
+		entry << "    { \"name\": \"" << name << "\"";
+		std::cerr << name << ":";
+		for (size_t i = 0; i < fields.size(); i++)
+		{
+			entry << ", \"" << fields[i].first << "\": " << fields[i].second;
+			std::cerr << " " << fields[i].first << "=" << fields[i].second;
+		}
+		entry << " }";
+		std::cerr << "\n";
+		entries.push_back(entry.str());
+	}
+
+	bool write(const std::string& path) const
+	{
+		std::ofstream file(path);
+		file << "{\n  \"benchmarks\": [\n";
+		for (size_t i = 0; i < entries.size(); i++)
+			file << entries[i] << (i + 1 < entries.size() ? ",\n" : "\n");
+		file << "  ]\n}\n";
+		return (bool)file;
+	}
+
+private:
+	std::vector<std::string> entries;
+};
+
+static Report report;
+
+//Checks which fail make the benchmark exit with 1, after the results are written.
+static unsigned int failures = 0;
+
+static void fail(const std::string& message)
+{
+	std::cerr << "FAILED: " << message << "\n";
+	failures++;
+}
+
+//Calls op(i) in batches until MIN_TIME has passed, and reports the time and the
+//allocations per call.
+template <class Op>
+static void measure(const std::string& name, Op op)
+{
+	const unsigned int batch = 1000;
+	unsigned long long iterations = 0;
+	unsigned long long allocations = allocationCount.load();
+	Clock::time_point start = Clock::now();
+	Clock::duration elapsed;
+	do
+	{
+		for (unsigned int i = 0; i < batch; i++)
+			op((unsigned int)(iterations + i));
+		iterations += batch;
+		elapsed = Clock::now() - start;
+	} while (elapsed < MIN_TIME);
+	allocations = allocationCount.load() - allocations;
+
+	double nanoseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	report.add(name, {
+		{ "ns_per_op", nanoseconds / iterations },
+		{ "ops_per_sec", iterations * 1e9 / nanoseconds },
+		{ "iterations", (double)iterations },
+		{ "allocations_per_op", (double)allocations / iterations } });
+}
+
+static double percentile(std::vector<long long>& samples, double fraction)
+{
+	size_t index = (size_t)(fraction * (samples.size() - 1));
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+	return (double)samples[index];
+}
+
+static void reportLatency(const std::string& name, std::vector<long long>& samples)
+{
+	report.add(name, {
+		{ "samples", (double)samples.size() },
+		{ "p50_ns", percentile(samples, 0.50) },
+		{ "p90_ns", percentile(samples, 0.90) },
+		{ "p99_ns", percentile(samples, 0.99) },
+		{ "max_ns", percentile(samples, 1.0) } });
+}
+
+//Every LaunchControl gets a loopback port of its own. Returns the deviceIndex to init it with,
+//and the port number to send to it.
+static unsigned int addDevicePort(unsigned int& portNumber)
+{
+	static unsigned int devices = 0;
+	std::ostringstream name;
+	name << LaunchControl::DEVICE_NAME << " (benchmark " << devices << ")";
+	portNumber = MidiLoopback::addPort(name.str());
+	return devices++;
+}
+
+//The first bytes of each control (PAD_n.data, KNOB_n_*.data), in the order of LaunchControl::Controls.
+static std::vector<const unsigned char*> controlBytes(const LaunchControl& launchControl)
+{
+	const unsigned char* controls[] = { launchControl.PAD_1.data, launchControl.PAD_2.data, launchControl.PAD_3.data, launchControl.PAD_4.data,
+		launchControl.PAD_5.data, launchControl.PAD_6.data, launchControl.PAD_7.data, launchControl.PAD_8.data,
+		launchControl.KNOB_1_LOW.data, launchControl.KNOB_2_LOW.data, launchControl.KNOB_3_LOW.data, launchControl.KNOB_4_LOW.data,
+		launchControl.KNOB_5_LOW.data, launchControl.KNOB_6_LOW.data, launchControl.KNOB_7_LOW.data, launchControl.KNOB_8_LOW.data,
+		launchControl.KNOB_1_UPPER.data, launchControl.KNOB_2_UPPER.data, launchControl.KNOB_3_UPPER.data, launchControl.KNOB_4_UPPER.data,
+		launchControl.KNOB_5_UPPER.data, launchControl.KNOB_6_UPPER.data, launchControl.KNOB_7_UPPER.data, launchControl.KNOB_8_UPPER.data };
+	return std::vector<const unsigned char*>(controls, controls + LaunchControl::UNKNOWN);
+}
+
+//The messages sent by every control of Factory template 1, and a few unknown ones.
+static std::vector<RtMidiEvent> controlMessages(const LaunchControl& launchControl)
+{
+	std::vector<const unsigned char*> controls = controlBytes(launchControl);
+	std::vector<RtMidiEvent> messages;
+	for (size_t i = 0; i < controls.size(); i++)
+	{
+		unsigned char message[3] = { controls[i][0], controls[i][1], (unsigned char)(i * 5) };
+		messages.push_back(RtMidiEvent::pack(message, 3));
+	}
+	const unsigned char unknown[][3] = { { 0xB0, 0x07, 0x40 }, { 0x90, 0x3C, 0x7F }, { 0xB8, 0x72, 0x7F }, { 0xE0, 0x00, 0x40 } };
+	for (int i = 0; i < 4; i++)
+		messages.push_back(RtMidiEvent::pack(unknown[i], 3));
+	return messages;
+}
+
+//The decoding done before the decode table: the first two bytes of the message compared with
+//those of each control, one control after the other.
+static LaunchControl::Controls decodeByComparing(const std::vector<const unsigned char*>& controls, const RtMidiEvent& message)
+{
+	unsigned char bytes[2] = { message.status(), message.data1() };
+	for (size_t control = 0; control < controls.size(); control++)
+	{
+		if (memcmp(controls[control], bytes, 2) == 0)
+			return (LaunchControl::Controls)control;
+	}
+	return LaunchControl::UNKNOWN;
+}
+
+static void benchmarkDecoding()
+{
+	unsigned int port;
+	unsigned int device = addDevicePort(port);
+	LaunchControl launchControl(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+	launchControl.init(device);
+
+	std::vector<RtMidiEvent> messages = controlMessages(launchControl);
+	const unsigned int count = (unsigned int)messages.size();
+
+	std::vector<const unsigned char*> controls = controlBytes(launchControl);
+
+	measure("decode_table", [&](unsigned int i) {
+		const RtMidiEvent& message = messages[i % count];
+		sink += launchControl.lookupControl(message.status(), message.data1());
+	});
+	measure("decode_memcmp_chain", [&](unsigned int i) {
+		sink += decodeByComparing(controls, messages[i % count]);
+	});
+	measure("messageToControl", [&](unsigned int i) {
+		sink += launchControl.messageToControl(messages[i % count]);
+		//Keeping room in the queue of update()
+		if ((i & 511) == 511)
+			launchControl.update();
+	});
+	measure("update_8_events", [&](unsigned int i) {
+		for (unsigned int j = 0; j < 8; j++)
+			launchControl.messageToControl(messages[(i * 8 + j) % count]);
+		sink += launchControl.update();
+	});
+	measure("getControlName", [&](unsigned int i) {
+		sink += (unsigned int)launchControl.getControlName(messages[i % count]).size();
+	});
+	measure("controlValues", [&](unsigned int i) {
+		LaunchControl::Controls control = (LaunchControl::Controls)(i % LaunchControl::UNKNOWN);
+		sink += launchControl.controlValues(control) != nullptr;
+	});
+	measure("snapshot", [&](unsigned int) {
+		sink += launchControl.snapshot().sequence;
+	});
+}
+
+//A thread writing the controls as the MIDI thread does, while other threads read them with
+//snapshot(). Every message of generation g gives its knob the value g & 0x7F and the arrival
+//time g, the knobs being written in order: a consistent copy has each value matching its time,
+//and the times of the knobs in write order going down by at most one generation.
+static void stressSnapshot()
+{
+	const unsigned int readerCount = 3;
+	const std::chrono::milliseconds duration(1000);
+	const int firstKnob = LaunchControl::KNOB_1;
+
+	LaunchControl launchControl(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+	std::vector<const unsigned char*> controls = controlBytes(launchControl);
+
+	std::atomic<bool> stopping(false);
+	std::atomic<unsigned long long> generations(0);
+	std::thread writer([&] {
+		for (long long generation = 1; !stopping.load(std::memory_order_relaxed); generation++)
+		{
+			for (int control = firstKnob; control < LaunchControl::UNKNOWN; control++)
+			{
+				unsigned char message[3] = { controls[control][0], controls[control][1], (unsigned char)(generation & 0x7F) };
+				RtMidiEvent event = RtMidiEvent::pack(message, 3);
+				event.arrivalTime = generation;
+				launchControl.messageToControl(event);
+			}
+			//Emptying the queue of update(), which nothing else reads here
+			if ((generation & 31) == 0)
+				launchControl.update();
+			generations.store(generation, std::memory_order_relaxed);
+		}
+	});
+
+	std::atomic<unsigned long long> snapshots(0);
+	std::atomic<unsigned long long> torn(0);
+	std::vector<std::thread> readers;
+	for (unsigned int i = 0; i < readerCount; i++)
+	{
+		readers.push_back(std::thread([&] {
+			unsigned long long count = 0, errors = 0;
+			while (!stopping.load(std::memory_order_relaxed))
+			{
+				LaunchControl::ControlSnapshot copy = launchControl.snapshot();
+				long long newest = copy.times[firstKnob];
+				bool consistent = (copy.sequence & 1) == 0;
+				for (int control = firstKnob; control < LaunchControl::UNKNOWN; control++)
+				{
+					long long time = copy.times[control];
+					if (copy.values[control] != (unsigned char)(time & 0x7F)
+						|| (control > firstKnob && time > copy.times[control - 1])
+						|| newest - time > 1)
+						consistent = false;
+				}
+				count++;
+				if (!consistent)
+					errors++;
+			}
+			snapshots.fetch_add(count);
+			torn.fetch_add(errors);
+		}));
+	}
+
+	std::this_thread::sleep_for(duration);
+	stopping.store(true);
+	writer.join();
+	for (size_t i = 0; i < readers.size(); i++)
+		readers[i].join();
+
+	report.add("snapshot_stress", {
+		{ "readers", (double)readerCount },
+		{ "generations", (double)generations.load() },
+		{ "snapshots", (double)snapshots.load() },
+		{ "torn", (double)torn.load() } });
+	if (torn.load() != 0)
+		fail("snapshot() returned torn or mixed copies of the controls");
+}
+
+static void benchmarkSysEx()
+{
+	unsigned int port;
+	unsigned int device = addDevicePort(port);
+	LaunchControl launchControl(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+	launchControl.init(device);
+
+	std::vector<unsigned char> data = { 0x02, 0x0A, 0x78, 0x08, 0x00, 0x0F };
+	measure("GetSysExMessage", [&](unsigned int i) {
+		data[4] = (unsigned char)(i & 7);
+		sink += (unsigned int)launchControl.GetSysExMessage(&data).size();
+	});
+
+	unsigned char fixedData[6] = { 0x02, 0x0A, 0x78, 0x08, 0x00, 0x0F };
+	measure("sysExMessage_fixed_size", [&](unsigned int i) {
+		fixedData[4] = (unsigned char)(i & 7);
+		sink += launchControl.sysExMessage(fixedData)[8];
+	});
+	measure("ledMessage_table", [&](unsigned int i) {
+		sink += LaunchControlSysEx::ledMessage(0x08, (unsigned char)(i % 12), (unsigned char)(i & 0x7F)).data[9];
+	});
+}
+
+static void benchmarkLeds()
+{
+	unsigned int port;
+	unsigned int device = addDevicePort(port);
+	LaunchControl launchControl(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+	launchControl.init(device);
+
+	//Each pad changes color every 8 calls, so every call sends a LED message.
+	measure("setPadColor_loopback", [&](unsigned int i) {
+		launchControl.setPadColor(i & 7, (i & 8) ? LaunchControl::RedFull : LaunchControl::GreenFull);
+	});
+	//Setting the color already shown costs no MIDI message.
+	measure("setPadColor_unchanged", [&](unsigned int i) {
+		launchControl.setPadColor(i & 7, LaunchControl::AmberFull);
+	});
+
+	launchControl.setAutoFlush(false);
+	measure("setAllPadColors_and_flush", [&](unsigned int i) {
+		launchControl.setAllPadColors(LaunchControl::ColorBrightness[i & 7]);
+		sink += launchControl.flush();
+	});
+
+	//The LED path must not allocate: setPadColor, flush and setTemplate, after a first round
+	//which may fill caches.
+	const unsigned int rounds = 10000;
+	unsigned long long allocations = 0;
+	for (unsigned int i = 0; i <= rounds; i++)
+	{
+		if (i == 1)
+			allocations = allocationCount.load();
+		launchControl.setPadColor(i & 7, LaunchControl::ColorBrightness[i & 7]);
+		sink += launchControl.flush();
+		launchControl.setTemplate((unsigned char)(LaunchControl::LED_TEMPLATE + (i & 1)));
+	}
+	allocations = allocationCount.load() - allocations;
+	launchControl.setTemplate(LaunchControl::LED_TEMPLATE);
+	launchControl.setAutoFlush(true);
+
+	report.add("led_path_allocations", {
+		{ "rounds", (double)rounds },
+		{ "allocations", (double)allocations } });
+	if (allocations != 0)
+		fail("setPadColor, flush and setTemplate allocated on the heap");
+}
+
+//A message sent to the port of a LaunchControl, decoded by its input callback.
+static void benchmarkInput()
+{
+	unsigned int port;
+	unsigned int device = addDevicePort(port);
+	LaunchControl launchControl(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+	launchControl.init(device);
+	RtMidiOut controller(RtMidi::RTMIDI_LOOPBACK);
+	controller.openPort(port);
+
+	unsigned char knob[3] = { launchControl.KNOB_1_LOW[0], launchControl.KNOB_1_LOW[1], 0 };
+	auto send = [&](unsigned int i) {
+		knob[2] = (unsigned char)(i & 0x7F);
+		controller.sendMessage(knob, 3);
+		if ((i & 511) == 511)
+			launchControl.update();
+	};
+	measure("input_dispatch_loopback", send);
+	measure("stats", [&](unsigned int) {
+		sink += (unsigned int)launchControl.stats().input.channelMessages[3];
+	});
+	launchControl.setLatencyTracking(true);
+	measure("input_dispatch_loopback_latency_tracked", send);
+}
+
+//RtMidiIn without a callback: messages are queued by the driver thread and read by the application.
+static void benchmarkQueue()
+{
+	const unsigned int queueSize = 4096;
+	unsigned int port = MidiLoopback::addPort("Queue (benchmark)");
+	RtMidiIn input(RtMidi::RTMIDI_LOOPBACK, "RtMidi Input Client", queueSize);
+	input.openPort(port);
+	RtMidiOut output(RtMidi::RTMIDI_LOOPBACK);
+	output.openPort(port);
+	unsigned char message[3] = { 0xB8, 0x15, 0x00 };
+
+	//The queue is filled, untimed, then emptied by the call being measured.
+	auto drain = [&](const std::string& name, unsigned int perCall, std::function<void()> call) {
+		unsigned long long iterations = 0;
+		unsigned long long allocations = 0;
+		Clock::duration elapsed(0);
+		while (elapsed < MIN_TIME)
+		{
+			for (unsigned int i = 0; i < queueSize; i++)
+			{
+				message[2] = (unsigned char)(i & 0x7F);
+				output.sendMessage(message, 3);
+			}
+			unsigned long long allocationsBefore = allocationCount.load();
+			Clock::time_point start = Clock::now();
+			for (unsigned int i = 0; i < queueSize / perCall; i++)
+				call();
+			elapsed += Clock::now() - start;
+			allocations += allocationCount.load() - allocationsBefore;
+			iterations += queueSize;
+		}
+		double nanoseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+		report.add(name, {
+			{ "ns_per_message", nanoseconds / iterations },
+			{ "messages_per_sec", iterations * 1e9 / nanoseconds },
+			{ "iterations", (double)iterations },
+			{ "allocations_per_message", (double)allocations / iterations } });
+	};
+
+	std::vector<unsigned char> bytes;
+	bytes.reserve(3);
+	drain("getMessage", 1, [&] { sink += (unsigned int)input.getMessage(&bytes); });
+	RtMidiEvent event;
+	drain("getEvent", 1, [&] { sink += input.getEvent(event); });
+	RtMidiEvent events[64];
+	drain("getMessages_batch_64", 64, [&] { sink += input.getMessages(events, 64); });
+}
+
+static void benchmarkRing()
+{
+	const unsigned int count = 1 << 22;
+	SpscRing<RtMidiEvent> ring(1024);
+	unsigned char message[3] = { 0xB8, 0x15, 0x00 };
+
+	for (int batched = 0; batched < 2; batched++)
+	{
+		Clock::time_point start = Clock::now();
+		std::thread producer([&] {
+			RtMidiEvent event = RtMidiEvent::pack(message, 3);
+			for (unsigned int i = 0; i < count; i++)
+			{
+				event.arrivalTime = i;
+				while (!ring.push(event))
+					std::this_thread::yield();
+			}
+		});
+
+		unsigned long long received = 0;
+		RtMidiEvent events[64];
+		while (received < count)
+		{
+			if (batched)
+			{
+				unsigned int popped = ring.popBatch(events, 64);
+				received += popped;
+				if (popped == 0)
+					std::this_thread::yield();
+			}
+			else if (ring.pop(events[0]))
+				received++;
+			else
+				std::this_thread::yield();
+		}
+		producer.join();
+
+		double nanoseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+		report.add(batched ? "spsc_ring_popBatch_64" : "spsc_ring_pop", {
+			{ "messages_per_sec", count * 1e9 / nanoseconds },
+			{ "ns_per_message", nanoseconds / count },
+			{ "messages", (double)count } });
+	}
+}
+
+//Many controllers at once: each instance gets its messages from a thread of its own.
+static void benchmarkInstances()
+{
+	const unsigned int instanceCount = 32;
+	const unsigned int messagesPerInstance = 200000;
+
+	std::vector<LaunchControl*> instances;
+	std::vector<unsigned int> ports;
+	for (unsigned int i = 0; i < instanceCount; i++)
+	{
+		unsigned int port;
+		unsigned int device = addDevicePort(port);
+		LaunchControl* launchControl = new LaunchControl(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+		launchControl->init(device);
+		instances.push_back(launchControl);
+		ports.push_back(port);
+	}
+
+	std::atomic<bool> go(false);
+	std::vector<std::thread> controllers;
+	for (unsigned int i = 0; i < instanceCount; i++)
+	{
+		controllers.push_back(std::thread([&, i] {
+			RtMidiOut controller(RtMidi::RTMIDI_LOOPBACK);
+			controller.openPort(ports[i]);
+			unsigned char knob[3] = { instances[i]->KNOB_1_LOW[0], instances[i]->KNOB_1_LOW[1], 0 };
+			while (!go.load())
+				std::this_thread::yield();
+			for (unsigned int n = 0; n < messagesPerInstance; n++)
+			{
+				knob[2] = (unsigned char)(n & 0x7F);
+				controller.sendMessage(knob, 3);
+			}
+		}));
+	}
+
+	Clock::time_point start = Clock::now();
+	go.store(true);
+	for (size_t i = 0; i < controllers.size(); i++)
+		controllers[i].join();
+	double nanoseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+	double total = (double)instanceCount * messagesPerInstance;
+	report.add("loopback_32_instances", {
+		{ "instances", (double)instanceCount },
+		{ "messages", total },
+		{ "messages_per_sec", total * 1e9 / nanoseconds } });
+
+	for (size_t i = 0; i < instances.size(); i++)
+		delete instances[i];
+}
+
+//Time from a pad press sent by the controller to the LED message echoed in toggle mode.
+static std::atomic<long long> ledArrival(0);
+
+static void onLedMessage(double, long long arrivalTime, const unsigned char*, size_t, void*)
+{
+	ledArrival.store(arrivalTime, std::memory_order_release);
+}
+
+//The pad presses reach the listener too, and are dropped instead of filling its queue.
+static void ignoreMessage(const RtMidiEvent&, void*)
+{
+}
+
+static void benchmarkPressToLed()
+{
+	const unsigned int samples = 20000;
+
+	unsigned int port;
+	unsigned int device = addDevicePort(port);
+	LaunchControl launchControl(true, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+	launchControl.init(device);
+
+	//Listening to the port as the device would, for the LED messages
+	RtMidiIn listener(RtMidi::RTMIDI_LOOPBACK);
+	listener.setCallback(ignoreMessage);
+	listener.setSysExCallback(onLedMessage);
+	listener.ignoreTypes(false, true, true);
+	listener.openPort(port);
+	RtMidiOut controller(RtMidi::RTMIDI_LOOPBACK);
+	controller.openPort(port);
+
+	//Each press toggles the pad, so every press changes the LED.
+	unsigned char press[3] = { launchControl.PAD_1[0], launchControl.PAD_1[1], 127 };
+
+	for (int threaded = 0; threaded < 2; threaded++)
+	{
+		if (threaded)
+			launchControl.startOutputThread(0);
+
+		std::vector<long long> latencies;
+		latencies.reserve(samples);
+		for (unsigned int i = 0; i < samples; i++)
+		{
+			ledArrival.store(0);
+			long long pressed = RtMidiEvent::now();
+			controller.sendMessage(press, 3);
+			long long arrival;
+			while ((arrival = ledArrival.load(std::memory_order_acquire)) == 0)
+				std::this_thread::yield();
+			latencies.push_back(arrival - pressed);
+			launchControl.update();
+		}
+		reportLatency(threaded ? "press_to_led_output_thread" : "press_to_led", latencies);
+
+		if (threaded)
+			launchControl.stopOutputThread();
+	}
+}
+
+//Time taken by setTemplate while the output thread preloads the other templates at the speed
+//of a MIDI link. The two templates switched between have nothing to preload, so only the wait
+//for the preloading to give way is measured.
+static void benchmarkTemplateSwitch()
+{
+	const unsigned int samples = 200;
+
+	unsigned int port;
+	unsigned int device = addDevicePort(port);
+	LaunchControl launchControl(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+	launchControl.init(device);
+	launchControl.startOutputThread(LaunchControl::MIDI_BYTES_PER_SECOND);
+
+	std::vector<long long> latencies;
+	latencies.reserve(samples);
+	for (unsigned int i = 0; i < samples; i++)
+	{
+		//New colors for templates 2 to 15, more than half a second of LED messages
+		for (int templateNumber = 2; templateNumber < LaunchControl::TEMPLATE_COUNT; templateNumber++)
+		{
+			for (int led = 0; led < LaunchControl::LED_COUNT; led++)
+				launchControl.preloadPadColor((unsigned char)templateNumber, led, LaunchControl::ColorBrightness[(i + led) & 7]);
+		}
+		//Letting the preloading start
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+		Clock::time_point start = Clock::now();
+		launchControl.setTemplate((unsigned char)(i & 1));
+		latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+	}
+	reportLatency("setTemplate_during_preload", latencies);
+
+	launchControl.stopOutputThread();
+}
+
+//A capture played back as fast as possible through the decode path of a LaunchControl.
+static void benchmarkReplay()
+{
+	const unsigned int count = 1 << 18;
+	const std::string path = "LaunchControlBenchmark.lcap";
+
+	{
+		LaunchControl reference(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+		std::vector<RtMidiEvent> messages = controlMessages(reference);
+		MidiCapture::Writer writer(count);
+		writer.open(path);
+		long long time = RtMidiEvent::now();
+		for (unsigned int i = 0; i < count; i++)
+		{
+			RtMidiEvent event = messages[i % messages.size()];
+			event.arrivalTime = time + i * 1000LL;
+			writer.capture(event);
+		}
+		writer.close();
+	}
+
+	unsigned int port = MidiReplay::addPort(LaunchControl::DEVICE_NAME + " (replay benchmark)", path, MidiReplay::MAX_SPEED);
+	LaunchControl launchControl(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_REPLAY);
+	Clock::time_point start = Clock::now();
+	launchControl.init();
+	MidiReplay::waitForEnd(port);
+	double nanoseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+	report.add("replay_max_speed", {
+		{ "messages", (double)count },
+		{ "messages_per_sec", count * 1e9 / nanoseconds },
+		{ "ns_per_message", nanoseconds / count } });
+	std::remove(path.c_str());
+}
+
+//Messages received by an RtMidiIn, with their time since the first one, from its time stamps.
+struct ReceivedMessage
+{
+	long long time;
+	std::vector<unsigned char> bytes;
+};
+
+struct ReceivedMessages
+{
+	double time;
+	std::vector<ReceivedMessage> messages;
+	//Size of messages, to wait for them from another thread
+	std::atomic<size_t> count;
+
+	ReceivedMessages() : time(0.0), count(0) {}
+
+	void add(double timeStamp, const unsigned char* bytes, size_t nBytes)
+	{
+		time += timeStamp;
+		ReceivedMessage message = { std::llround(time * 1e9), std::vector<unsigned char>(bytes, bytes + nBytes) };
+		messages.push_back(message);
+		count.store(messages.size(), std::memory_order_release);
+	}
+};
+
+static void onReceivedMessage(const RtMidiEvent& event, void* userData)
+{
+	unsigned char bytes[3] = { event[0], event[1], event[2] };
+	((ReceivedMessages*)userData)->add(event.timeStamp, bytes, event.size());
+}
+
+static void onReceivedSysEx(double timeStamp, long long, const unsigned char* bytes, size_t nBytes, void* userData)
+{
+	((ReceivedMessages*)userData)->add(timeStamp, bytes, nBytes);
+}
+
+//A capture exported to Standard MIDI Files of format 0 and 1 must replay the same messages in
+//the same order, SysEx included, at times rounded to the nearest tick. Notes on one channel
+//interleaved with other channels, SysEx and system messages check that running status is
+//resent, or kept, where it should be in each track.
+static void checkMidiFileRoundTrip()
+{
+	const std::string capturePath = "LaunchControlBenchmark.lcap";
+	const std::string midiPath = "LaunchControlBenchmark.mid";
+	//Two messages are more than 2 ticks apart, so the rounding cannot swap them
+	const long long spacing = 3000000;
+	const long long tick = (long long)MidiFile::DEFAULT_TEMPO * 1000 / MidiFile::DEFAULT_DIVISION;
+
+	std::vector<ReceivedMessage> expected;
+	{
+		MidiCapture::Writer writer;
+		writer.open(capturePath);
+		long long start = RtMidiEvent::now();
+		for (unsigned char i = 0; i < 240; i++)
+		{
+			//Up to half a millisecond off the spacing, so most times fall between two ticks
+			long long time = i * spacing + (i * 37 % 500) * 1000;
+			std::vector<unsigned char> bytes;
+			switch (i % 12)
+			{
+			case 0: case 1: case 2: case 4: bytes = { 0x90, (unsigned char)(60 + i % 12), (unsigned char)(i % 3 == 2 ? 0 : 100) }; break;
+			case 3: bytes = { 0xB1, 0x07, (unsigned char)(i & 0x7F) }; break;
+			case 5: case 6: bytes = { 0xC9, (unsigned char)(i & 0x7F) }; break;
+			case 7: bytes = { 0xF8 }; break;
+			case 8: bytes = { 0x80, 60, 0x40 }; break;
+			case 9:
+				bytes = { 0xF0, 0x7D };
+				for (unsigned char b = 0; b < 5 + i % 40; b++)
+					bytes.push_back(b);
+				bytes.push_back(0xF7);
+				break;
+			case 10: bytes = { 0xF2, (unsigned char)(i & 0x7F), 0x01 }; break;
+			default: bytes = i % 24 == 11 ? std::vector<unsigned char>{ 0xE1, 0x00, 0x40 } : std::vector<unsigned char>{ 0xF6 }; break;
+			}
+			if (bytes[0] == 0xF0)
+				writer.captureSysEx(start + time, bytes.data(), bytes.size());
+			else
+				writer.capture(RtMidiEvent::pack(bytes.data(), (unsigned int)bytes.size(), 0.0, start + time));
+			ReceivedMessage message = { time, bytes };
+			expected.push_back(message);
+		}
+		writer.close();
+	}
+
+	for (unsigned short format = 0; format < 2; format++)
+	{
+		std::ostringstream name;
+		name << LaunchControl::DEVICE_NAME << " (format " << format << " replay)";
+		MidiFile::exportCapture(capturePath, midiPath, format);
+		unsigned int port = MidiReplay::addPort(name.str(), midiPath, MidiReplay::MAX_SPEED);
+
+		ReceivedMessages replayed;
+		RtMidiIn input(RtMidi::RTMIDI_REPLAY);
+		input.ignoreTypes(false, false, false);
+		input.setCallback(onReceivedMessage, &replayed);
+		input.setSysExCallback(onReceivedSysEx, &replayed);
+		input.openPort(port);
+		MidiReplay::waitForEnd(port);
+		input.closePort();
+
+		std::ostringstream prefix;
+		prefix << "midi_file_round_trip: format " << format << ", ";
+		if (replayed.messages.size() != expected.size())
+		{
+			std::ostringstream message;
+			message << prefix.str() << replayed.messages.size() << " messages replayed instead of " << expected.size();
+			fail(message.str());
+			continue;
+		}
+		for (size_t i = 0; i < expected.size(); i++)
+		{
+			std::ostringstream message;
+			message << prefix.str() << "message " << i;
+			if (replayed.messages[i].bytes != expected[i].bytes)
+				fail(message.str() + " differs from the captured one");
+			//The first message replayed is at time 0, and both times are rounded by up to half a tick
+			else if (std::llabs(replayed.messages[i].time - (expected[i].time - expected[0].time)) > tick + 1000)
+				fail(message.str() + " is more than a tick off its captured time");
+		}
+	}
+	std::remove(capturePath.c_str());
+	std::remove(midiPath.c_str());
+}
+
+#if defined(__LINUX_FD__)
+//The byte stream parser of the LINUX_FD API, fed through a pipe: running status, real-time
+//messages inside other messages, SysEx aborted by a status byte, and a SysEx larger than the
+//pipe, which the output writes in several parts, waiting each time the pipe is full (EAGAIN).
+static void checkFdParsing()
+{
+	const std::vector<std::vector<unsigned char>> stream = {
+		//Running status
+		{ 0x90, 0x3C, 0x40, 0x3E, 0x41 },
+		//Real-time inside a channel message, keeping the running status
+		{ 0xB0, 0x07, 0xF8, 0x64, 0x08, 0x22 },
+		//Real-time inside a SysEx, then data bytes without a status after it
+		{ 0xF0, 0x7D, 0x01, 0xFE, 0x02, 0xF7, 0x10, 0x20 },
+		//SysEx aborted by a note on, which is received
+		{ 0xF0, 0x7D, 0x03, 0x04, 0x92, 0x40, 0x7F },
+		//System common messages cancel running status
+		{ 0xF2, 0x01, 0x02, 0x05, 0x06, 0xF6 },
+		//A message split over two writes, with running status of a single data byte
+		{ 0xC3, 0x05 },
+		{ 0x06 } };
+	std::vector<std::vector<unsigned char>> expected = {
+		{ 0x90, 0x3C, 0x40 }, { 0x90, 0x3E, 0x41 },
+		{ 0xF8 }, { 0xB0, 0x07, 0x64 }, { 0xB0, 0x08, 0x22 },
+		{ 0xFE }, { 0xF0, 0x7D, 0x01, 0x02, 0xF7 },
+		{ 0x92, 0x40, 0x7F },
+		{ 0xF2, 0x01, 0x02 }, { 0xF6 },
+		{ 0xC3, 0x05 }, { 0xC3, 0x06 } };
+
+	std::vector<unsigned char> sysex(256 * 1024);
+	for (size_t i = 0; i < sysex.size(); i++)
+		sysex[i] = (unsigned char)(i & 0x7F);
+	sysex.front() = 0xF0;
+	sysex.back() = 0xF7;
+	expected.push_back(sysex);
+	expected.push_back({ 0x80, 0x3C, 0x00 });
+
+	int fds[2];
+	if (pipe(fds) != 0)
+	{
+		fail("fd_parsing: cannot create a pipe");
+		return;
+	}
+	//A small pipe, which the SysEx fills many times
+	fcntl(fds[1], F_SETPIPE_SZ, 4096);
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+	unsigned int port = MidiFd::addPort(LaunchControl::DEVICE_NAME + " (fd benchmark)", fds[0], fds[1]);
+
+	ReceivedMessages received;
+	RtMidiIn input(RtMidi::LINUX_FD);
+	input.ignoreTypes(false, false, false);
+	input.setCallback(onReceivedMessage, &received);
+	input.setSysExCallback(onReceivedSysEx, &received);
+	input.openPort(port);
+	RtMidiOut output(RtMidi::LINUX_FD);
+	output.openPort(port);
+
+	for (size_t i = 0; i < stream.size(); i++)
+	{
+		if (write(fds[1], stream[i].data(), stream[i].size()) != (ssize_t)stream[i].size())
+			fail("fd_parsing: cannot write to the pipe");
+		//Most likely read one write at a time, so the parser keeps its state between reads
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	output.sendMessage(sysex.data(), sysex.size());
+	output.sendMessage(expected.back().data(), expected.back().size());
+
+	Clock::time_point deadline = Clock::now() + std::chrono::seconds(5);
+	while (received.count.load(std::memory_order_acquire) < expected.size() && Clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	output.closePort();
+	input.closePort();
+	close(fds[0]);
+	close(fds[1]);
+
+	if (received.messages.size() != expected.size())
+	{
+		std::ostringstream message;
+		message << "fd_parsing: " << received.messages.size() << " messages received instead of " << expected.size();
+		fail(message.str());
+		return;
+	}
+	for (size_t i = 0; i < expected.size(); i++)
+	{
+		if (received.messages[i].bytes != expected[i])
+		{
+			std::ostringstream message;
+			message << "fd_parsing: message " << i << " differs from the one sent";
+			fail(message.str());
+		}
+	}
+}
+#endif
+
+//Listens to the port of a LaunchControl as the device would, recording the LED messages and
+//buffer controls it is sent.
+static void monitorDevice(RtMidiIn& monitor, unsigned int port, ReceivedMessages& received)
+{
+	monitor.setCallback(onReceivedMessage, &received);
+	monitor.setSysExCallback(onReceivedSysEx, &received);
+	monitor.ignoreTypes(false, false, false);
+	monitor.openPort(port);
+}
+
+//F0h 00h 20h 29h 02h 0Ah 78h Template LED Value F7h
+static std::vector<unsigned char> ledBytes(unsigned char templateNumber, unsigned char led, unsigned char velocity)
+{
+	return { 0xF0, 0x00, 0x20, 0x29, 0x02, 0x0A, 0x78, templateNumber, led, velocity, 0xF7 };
+}
+
+//Waits for the messages received since the first ones, then fails if they differ from expected.
+static void expectMessages(const std::string& name, ReceivedMessages& received, size_t first, const std::vector<std::vector<unsigned char>>& expected)
+{
+	Clock::time_point deadline = Clock::now() + std::chrono::seconds(2);
+	while (received.count.load(std::memory_order_acquire) < first + expected.size() && Clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	//Anything sent by mistake right after
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	size_t count = received.count.load(std::memory_order_acquire) - first;
+	if (count != expected.size())
+	{
+		std::ostringstream message;
+		message << name << ": " << count << " messages instead of " << expected.size();
+		fail(message.str());
+		return;
+	}
+	for (size_t i = 0; i < expected.size(); i++)
+	{
+		if (received.messages[first + i].bytes != expected[i])
+		{
+			std::ostringstream message;
+			message << name << ": message " << i << " is not the one expected";
+			fail(message.str());
+		}
+	}
+}
+
+//The buffer controls of double buffering: B8h 00h 34h when enabled (buffer 0 displayed, buffer 1
+//written), a swap after each flush which writes LEDs, alternately 31h and 34h, and 20h when
+//disabled. LEDs are written to the hidden buffer only, without the Clear and Copy flags.
+static void checkDoubleBuffering()
+{
+	unsigned int port;
+	unsigned int device = addDevicePort(port);
+	LaunchControl launchControl(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+	launchControl.init(device);
+	launchControl.setAutoFlush(false);
+	ReceivedMessages received;
+	RtMidiIn monitor(RtMidi::RTMIDI_LOOPBACK);
+	monitorDevice(monitor, port, received);
+
+	const unsigned char tmpl = LaunchControl::LED_TEMPLATE;
+	const unsigned char status = 0xB0 + tmpl;
+	size_t first = received.count.load();
+	launchControl.setDoubleBuffered(tmpl, true);
+	launchControl.setPadColor(0, LaunchControl::RedFull);
+	launchControl.setPadColor(1, LaunchControl::GreenFull);
+	launchControl.flush();
+	launchControl.setPadColor(0, LaunchControl::Off);
+	launchControl.flush();
+	//Nothing changed, nothing to swap
+	launchControl.flush();
+	launchControl.setDoubleBuffered(tmpl, false);
+	launchControl.setPadColor(1, LaunchControl::Off);
+	launchControl.flush();
+	expectMessages("double_buffering", received, first, {
+		{ status, 0x00, 0x34 },
+		ledBytes(tmpl, 0, 0x03), ledBytes(tmpl, 1, 0x30), { status, 0x00, 0x31 },
+		ledBytes(tmpl, 0, 0x00), { status, 0x00, 0x34 },
+		{ status, 0x00, 0x20 },
+		ledBytes(tmpl, 1, LaunchControl::Off) });
+	monitor.closePort();
+}
+
+//The first flashing LED of a template turns its flash mode on with B8h 00h 28h, sent before
+//the LED. Flashing LEDs have the Clear flag without Copy, so the device clears them in the
+//other buffer, and a steady color set afterwards has both flags again.
+static void checkFlashing()
+{
+	unsigned int port;
+	unsigned int device = addDevicePort(port);
+	LaunchControl launchControl(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+	launchControl.init(device);
+	ReceivedMessages received;
+	RtMidiIn monitor(RtMidi::RTMIDI_LOOPBACK);
+	monitorDevice(monitor, port, received);
+
+	const unsigned char tmpl = LaunchControl::LED_TEMPLATE;
+	size_t first = received.count.load();
+	launchControl.setPadFlashing(2, LaunchControl::RedFull);
+	launchControl.setPadFlashing(3, LaunchControl::GreenFull);
+	launchControl.setPadColor(2, LaunchControl::RedFull);
+	expectMessages("flashing", received, first, {
+		{ (unsigned char)(0xB0 + tmpl), 0x00, 0x28 }, ledBytes(tmpl, 2, 0x0B),
+		ledBytes(tmpl, 3, 0x38),
+		ledBytes(tmpl, 2, LaunchControl::RedFull) });
+	monitor.closePort();
+}
+
+//Each handler call is recorded as a message of 3 bytes: which handler, the control and its value.
+static const unsigned char PAD_HANDLER = 'P';
+static const unsigned char KNOB_HANDLER = 'K';
+static const unsigned char ANY_HANDLER = 'A';
+static const unsigned char LISTENER = 'L';
+
+static void recordCall(void* userData, unsigned char handler, LaunchControl::Controls control, unsigned char value)
+{
+	unsigned char bytes[3] = { handler, (unsigned char)control, value };
+	((ReceivedMessages*)userData)->add(0.0, bytes, 3);
+}
+
+static void onPadCalled(LaunchControl&, LaunchControl::Controls control, unsigned char value, const RtMidiEvent&, void* userData)
+{
+	recordCall(userData, PAD_HANDLER, control, value);
+}
+
+static void onKnobCalled(LaunchControl&, LaunchControl::Controls control, unsigned char value, const RtMidiEvent&, void* userData)
+{
+	recordCall(userData, KNOB_HANDLER, control, value);
+}
+
+static void onAnyCalled(LaunchControl&, LaunchControl::Controls control, unsigned char value, const RtMidiEvent&, void* userData)
+{
+	recordCall(userData, ANY_HANDLER, control, value);
+}
+
+class RecordingListener : public LaunchControlListener<RecordingListener>
+{
+public:
+	explicit RecordingListener(ReceivedMessages& calls) : LaunchControlListener<RecordingListener>(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK), calls(calls) {}
+
+	void onControl(LaunchControl::Controls control, unsigned char value, const RtMidiEvent&)
+	{
+		recordCall(&calls, LISTENER, control, value);
+	}
+
+private:
+	ReceivedMessages& calls;
+};
+
+//The handler of the control is called before the onAny handler, and controls without one only
+//reach onAny. Pads toggle on every press, from their initial value. A LaunchControlListener calls onControl for every known control instead, and none
+//of the handlers. Unknown messages call nothing.
+static void checkHandlers()
+{
+	for (int listener = 0; listener < 2; listener++)
+	{
+		unsigned int port;
+		unsigned int device = addDevicePort(port);
+		ReceivedMessages calls;
+		LaunchControl* launchControl = listener
+			? new RecordingListener(calls)
+			: new LaunchControl(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+		launchControl->onPad(1, onPadCalled, &calls);
+		launchControl->onKnob(1, onKnobCalled, &calls);
+		launchControl->onAny(onAnyCalled, &calls);
+		launchControl->init(device);
+
+		RtMidiOut controller(RtMidi::RTMIDI_LOOPBACK);
+		controller.openPort(port);
+		const unsigned char messages[][3] = {
+			{ launchControl->PAD_1[0], launchControl->PAD_1[1], 127 },
+			{ launchControl->KNOB_1_LOW[0], launchControl->KNOB_1_LOW[1], 10 },
+			{ launchControl->KNOB_1_UPPER[0], launchControl->KNOB_1_UPPER[1], 20 },
+			{ launchControl->PAD_2[0], launchControl->PAD_2[1], 127 },
+			{ 0xB0, 0x07, 0x40 },
+			{ launchControl->PAD_1[0], launchControl->PAD_1[1], 127 } };
+		const unsigned char pad1 = launchControl->PAD_1[2];
+		const unsigned char pad2 = launchControl->PAD_2[2];
+		for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++)
+			controller.sendMessage(messages[i], 3);
+
+		if (listener)
+			expectMessages("listener_calls", calls, 0, {
+				{ LISTENER, LaunchControl::PAD1, (unsigned char)(127 - pad1) },
+				{ LISTENER, LaunchControl::KNOB_1, 10 },
+				{ LISTENER, LaunchControl::KNOB_9, 20 },
+				{ LISTENER, LaunchControl::PAD2, (unsigned char)(127 - pad2) },
+				{ LISTENER, LaunchControl::PAD1, pad1 } });
+		else
+			expectMessages("handler_calls", calls, 0, {
+				{ PAD_HANDLER, LaunchControl::PAD1, (unsigned char)(127 - pad1) }, { ANY_HANDLER, LaunchControl::PAD1, (unsigned char)(127 - pad1) },
+				{ KNOB_HANDLER, LaunchControl::KNOB_1, 10 }, { ANY_HANDLER, LaunchControl::KNOB_1, 10 },
+				{ ANY_HANDLER, LaunchControl::KNOB_9, 20 },
+				{ ANY_HANDLER, LaunchControl::PAD2, (unsigned char)(127 - pad2) },
+				{ PAD_HANDLER, LaunchControl::PAD1, pad1 }, { ANY_HANDLER, LaunchControl::PAD1, pad1 } });
+		controller.closePort();
+		delete launchControl;
+	}
+}
+
+//Makes every LED message take 5ms to reach the device.
+static void onLedSlowly(double, long long, const unsigned char*, size_t, void*)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+}
+
+//A fade from red to green goes through the red and green levels in between, rounded, keeping
+//the flags of the first keyframe, and the animator sends each step once. A tick taking longer
+//than the period makes the next ticks late, which are skipped and counted as missed, so that
+//the ticks played and missed still follow the clock.
+static void checkLedAnimator()
+{
+	typedef std::chrono::milliseconds ms;
+	const unsigned char tmpl = LaunchControl::LED_TEMPLATE;
+	const unsigned char steps[] = { 0x0F, 0x1E, 0x2D, 0x3C };
+
+	{
+		unsigned int port;
+		unsigned int device = addDevicePort(port);
+		LaunchControl launchControl(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+		launchControl.init(device);
+		ReceivedMessages received;
+		RtMidiIn monitor(RtMidi::RTMIDI_LOOPBACK);
+		monitorDevice(monitor, port, received);
+
+		LedAnimator animator(launchControl);
+		animator.addKeyframe(0, ms(0), LaunchControl::RedFull);
+		animator.addKeyframe(0, ms(300), LaunchControl::GreenFull, LedAnimator::Fade);
+
+		//Two of the times between are rounded to the same step
+		const long long times[] = { 0, 100, 150, 200, 300, 400 };
+		const unsigned char colors[] = { steps[0], steps[1], steps[2], steps[2], steps[3], steps[3] };
+		unsigned char rendered[LaunchControl::LED_COUNT];
+		for (int i = 0; i < 6; i++)
+		{
+			animator.colorsAt(ms(times[i]), rendered);
+			if (rendered[0] != colors[i] || rendered[1] != LedAnimator::UNSET)
+			{
+				std::ostringstream message;
+				message << "led_animator: wrong colors at " << times[i] << "ms";
+				fail(message.str());
+			}
+		}
+
+		//One tick per step
+		size_t first = received.count.load();
+		animator.start(ms(100));
+		expectMessages("led_animator_fade", received, first, {
+			ledBytes(tmpl, 0, steps[0]), ledBytes(tmpl, 0, steps[1]), ledBytes(tmpl, 0, steps[2]), ledBytes(tmpl, 0, steps[3]) });
+		animator.stop();
+		monitor.closePort();
+	}
+
+	{
+		unsigned int port;
+		unsigned int device = addDevicePort(port);
+		LaunchControl launchControl(false, LaunchControl::LogMode::ERR, RtMidi::RTMIDI_LOOPBACK);
+		launchControl.init(device);
+		RtMidiIn monitor(RtMidi::RTMIDI_LOOPBACK);
+		monitor.setCallback(ignoreMessage);
+		monitor.setSysExCallback(onLedSlowly);
+		monitor.ignoreTypes(false, true, true);
+		monitor.openPort(port);
+
+		//A new color every millisecond, so that every tick sends a LED
+		const ms period(1);
+		LedAnimator animator(launchControl);
+		for (int i = 0; i < 100; i++)
+			animator.addKeyframe(0, ms(i), i % 2 ? LaunchControl::GreenFull : LaunchControl::RedFull);
+		animator.setLoopDuration(ms(100));
+
+		Clock::time_point start = Clock::now();
+		animator.start(period);
+		std::this_thread::sleep_for(ms(200));
+		animator.stop();
+		long long elapsed = std::chrono::duration_cast<ms>(Clock::now() - start).count() / period.count();
+
+		//Every tick is 5 periods long. The last ones may not have been played nor skipped yet.
+		unsigned long long ticks = animator.ticks();
+		unsigned long long missed = animator.missedTicks();
+		if (missed == 0 || ticks * 2 > (unsigned long long)elapsed || ticks + missed > (unsigned long long)elapsed + 1 || ticks + missed + 20 < (unsigned long long)elapsed)
+		{
+			std::ostringstream message;
+			message << "led_animator: " << ticks << " ticks played and " << missed << " missed in " << elapsed << " periods";
+			fail(message.str());
+		}
+		monitor.closePort();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::string path = argc > 1 ? argv[1] : "LaunchControlBenchmark.json";
+
+	try {
+		benchmarkDecoding();
+		stressSnapshot();
+		benchmarkSysEx();
+		benchmarkLeds();
+		benchmarkInput();
+		benchmarkQueue();
+		benchmarkRing();
+		benchmarkInstances();
+		benchmarkPressToLed();
+		benchmarkTemplateSwitch();
+		benchmarkReplay();
+		checkDoubleBuffering();
+		checkFlashing();
+		checkHandlers();
+		checkLedAnimator();
+		checkMidiFileRoundTrip();
+#if defined(__LINUX_FD__)
+		checkFdParsing();
+#endif
+	}
+	catch (RtMidiError &error) {
+		error.printMessage();
+		return 1;
+	}
+
+	if (!report.write(path))
+	{
+		std::cerr << "Cannot write " << path << "\n";
+		return 1;
+	}
+	std::cerr << "Results written to " << path << "\n";
+	return failures == 0 ? 0 : 1;
+}
@@ -3,6 +3,7 @@
 
 #include "stdafx.h"
 #include "../LaunchControl/LaunchControl.h"
+#include "../LaunchControl/LedAnimator.h"
 #include <iostream>
 #include <chrono>
 #include <thread>
@@ -36,17 +37,24 @@ int main()
 		launchControl->setTemplate(templateNumber);
 
 
-		int i = 0;
-		// i being a multiple of number of pads makes complete rounds
-		// 72 will make each pad flash once with each of 8 colors
-		while (i < 16)
+		//One keyframe every 100ms, lighting the pads one after the other.
+		// Keyframe i sets pad i % 8 to color i / 8 of ColorBrightness, so each round
+		// of 8 keyframes over the pads moves on to the next color. The 16 keyframes
+		// below play two rounds in 1.6s; 64 would play every color once.
+		LedAnimator animator(*launchControl, templateNumber);
+		for (int i = 0; i < 16; i++)
 		{
-			std::vector<unsigned char> message;
-			std::cout << "Sending control message...\n";
-			launchControl->setPadColor(i % 8,
+			animator.addKeyframe(i % 8, std::chrono::milliseconds(100 * i),
 				//this makes the PAD be either Red(7) or off (0)
 				LaunchControl::ColorBrightness[(i / 8) % 8]// *((i / 8) % 2)]
 				);
+		}
+		animator.start();
+
+		int i = 0;
+		while (i < 16)
+		{
+			launchControl->update();
 			if(launchControl->PAD_1.On())
 			{
 				std::cout << "PAD 1 is ON";
@@ -56,6 +64,8 @@ int main()
 			++i;
 		}
 
+		animator.stop();
+
 		std::cout << "\nReading MIDI input ... press <enter> to quit.\n";
 
 		char input;